@@ -13,66 +13,384 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <complex>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <numeric>
 #include <optional>
 #include <stdexcept>
+#include <thread>
 #include <vector>
 
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define STL_COROUTINES
+#endif
+
 namespace stl {
 
-bool est(const float* y, size_t n, size_t len, int ideg, float xs, float* ys, size_t nleft, size_t nright, float* w, bool userw, const float* rw) {
-    auto range = ((float) n) - 1.0;
-    auto h = std::max(xs - ((float) nleft), ((float) nright) - xs);
+// runs the tasks of the parallel functions
+// implement it to run them on an existing thread pool
+class Executor {
+public:
+    virtual ~Executor() = default;
+
+    // runs the task, usually on another thread, and must not block until it finishes
+    virtual void submit(std::function<void()> task) = 0;
+
+    // number of tasks that can run at once
+    virtual size_t concurrency() const = 0;
+};
+
+// a fixed set of threads that run tasks in the order they are submitted
+class ThreadPool : public Executor {
+    std::vector<std::thread> threads_;
+    std::deque<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    bool stop_ = false;
+
+public:
+    // 0 uses the number of hardware threads
+    explicit ThreadPool(size_t threads = 0) {
+        if (threads == 0) {
+            threads = std::max(std::thread::hardware_concurrency(), 1u);
+        }
+        for (size_t t = 0; t < threads; t++) {
+            threads_.emplace_back([this]() {
+                while (true) {
+                    std::function<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex_);
+                        ready_.wait(lock, [this]() { return stop_ || !tasks_.empty(); });
+                        if (tasks_.empty()) {
+                            return;
+                        }
+                        task = std::move(tasks_.front());
+                        tasks_.pop_front();
+                    }
+                    task();
+                }
+            });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // runs the tasks already submitted, then joins the threads
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        ready_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    inline void submit(std::function<void()> task) override {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.push_back(std::move(task));
+        }
+        ready_.notify_one();
+    }
+
+    inline size_t concurrency() const override {
+        return threads_.size();
+    }
+};
+
+// the pool used when no executor is given, with one thread per hardware thread
+ThreadPool& default_executor() {
+    static ThreadPool pool;
+    return pool;
+}
+
+// the number of tasks that can run at once, treating an executor that reports 0 as 1
+size_t concurrency(const Executor& executor) {
+    return std::max(executor.concurrency(), (size_t) 1);
+}
+
+// calls f(slot, i) for each i in [0, count) on the calling thread and up to workers - 1 tasks
+// calls with the same slot never overlap, and slot is less than workers
+// callers read concurrency once and size their per-slot buffers from workers, since it can change between calls
+// tasks that start after every i is taken return without calling f, so a busy executor cannot deadlock
+// the first exception is rethrown
+template <typename F>
+void parallel_for(size_t count, size_t workers, Executor& executor, F f) {
+    workers = std::min(workers, count);
+    if (workers <= 1) {
+        for (size_t i = 0; i < count; i++) {
+            f(0, i);
+        }
+        return;
+    }
+
+    struct State {
+        std::atomic<size_t> next{0};
+        std::mutex mutex;
+        std::condition_variable finished;
+        size_t slots = 1;
+        size_t active = 0;
+        bool closed = false;
+        std::exception_ptr error;
+    };
+    auto state = std::make_shared<State>();
+
+    auto run = [count](State& state, F& f, size_t slot) {
+        try {
+            for (size_t i = state.next++; i < count; i = state.next++) {
+                f(slot, i);
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            if (!state.error) {
+                state.error = std::current_exception();
+            }
+            state.next = count;
+        }
+    };
+
+    auto fp = &f;
+    for (size_t t = 1; t < workers; t++) {
+        executor.submit([state, fp, run]() {
+            size_t slot = 0;
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                if (state->closed) {
+                    return;
+                }
+                slot = state->slots++;
+                state->active += 1;
+            }
+            run(*state, *fp, slot);
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->active -= 1;
+            }
+            state->finished.notify_all();
+        });
+    }
+
+    run(*state, f, 0);
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->closed = true;
+    state->finished.wait(lock, [&]() { return state->active == 0; });
+    if (state->error) {
+        std::rethrow_exception(state->error);
+    }
+}
+
+// stops a fit from another thread
+class CancellationToken {
+    std::atomic<bool> cancelled_{false};
+
+public:
+    inline void cancel() {
+        cancelled_.store(true, std::memory_order_relaxed);
+    }
+
+    inline bool cancelled() const {
+        return cancelled_.load(std::memory_order_relaxed);
+    }
+};
+
+// thrown from a fit when its token is cancelled
+class CancelledError : public std::runtime_error {
+public:
+    CancelledError() : std::runtime_error("fit was cancelled") {}
+};
+
+// points fitted by ess between checks of the token
+const size_t cancel_interval = 1024;
+
+// x-values 1, 2, ..., n
+struct UnitPositions {
+    inline float operator()(size_t j) const {
+        return (float) j;
+    }
+
+    inline double range(size_t n) const {
+        return ((float) n) - 1.0;
+    }
+
+    // distance covered by k points
+    inline float span(size_t, size_t k) const {
+        return (float) k;
+    }
+};
+
+// sorted x-values, x[j - 1] for point j
+struct SortedPositions {
+    const float* x;
+
+    inline float operator()(size_t j) const {
+        return x[j - 1];
+    }
+
+    inline double range(size_t n) const {
+        return x[n - 1] - x[0];
+    }
+
+    // distance covered by k points at the average spacing
+    inline float span(size_t n, size_t k) const {
+        return n > 1 ? k * ((x[n - 1] - x[0]) / (n - 1)) : 0.0;
+    }
+};
+
+// specialized on the degree and on whether robustness weights are used
+// slope, if not null, gets the slope of the local fit at xs (zero for degree 0)
+template <int ideg, bool userw, typename Positions = UnitPositions>
+bool est(const float* y, size_t n, size_t len, float xs, float* ys, size_t nleft, size_t nright, float* w, const float* rw, float* slope, const Positions& x = Positions()) {
+    auto range = x.range(n);
+    auto h = std::max(xs - x(nleft), x(nright) - xs);
 
     if (len > n) {
-        h += (float) ((len - n) / 2);
+        h += x.span(n, (len - n) / 2);
     }
 
     auto h9 = 0.999 * h;
     auto h1 = 0.001 * h;
 
     // compute weights
+    // for degree 2, also accumulate the moments of u = x - xs and of u * y
     auto a = 0.0;
+    double s1 = 0.0, s2 = 0.0, s3 = 0.0, s4 = 0.0;
+    double t0 = 0.0, t1 = 0.0, t2 = 0.0;
     for (auto j = nleft; j <= nright; j++) {
         w[j - 1] = 0.0;
-        auto r = fabs(((float) j) - xs);
+        auto r = fabs(x(j) - xs);
         if (r <= h9) {
             if (r <= h1) {
                 w[j - 1] = 1.0;
             } else {
-                w[j - 1] = pow(1.0 - pow(r / h, 3), 3);
+                double q = r / h;
+                auto t = 1.0 - q * q * q;
+                w[j - 1] = t * t * t;
             }
             if (userw) {
                 w[j - 1] *= rw[j - 1];
             }
             a += w[j - 1];
+            if (ideg == 2) {
+                double u = x(j) - xs;
+                double wu = w[j - 1] * u;
+                double wu2 = wu * u;
+                double wy = w[j - 1] * y[j - 1];
+                s1 += wu;
+                s2 += wu2;
+                s3 += wu2 * u;
+                s4 += wu2 * u * u;
+                t0 += wy;
+                t1 += wy * u;
+                t2 += wy * u * u;
+            }
         }
     }
 
     if (a <= 0.0) {
         return false;
+    } else if (ideg == 2) { // weighted least squares from the moments
+        s1 /= a;
+        s2 /= a;
+        s3 /= a;
+        s4 /= a;
+        t0 /= a;
+        t1 /= a;
+        t2 /= a;
+
+        *ys = t0;
+        if (slope != nullptr) {
+            *slope = 0.0;
+        }
+
+        // variance of x, and of x^2 after removing its projection on 1 and x
+        // as with degree 1, the slope only needs distinct points
+        auto m2 = s2 - s1 * s1;
+        if (h > 0.0 && sqrt(std::max(m2, 0.0)) > 0.000001 * h) {
+            auto spread = sqrt(m2) > 0.001 * range;
+            auto m3 = s3 - 3.0 * s1 * s2 + 2.0 * s1 * s1 * s1;
+            auto m4 = s4 - 4.0 * s1 * s3 + 6.0 * s1 * s1 * s2 - 3.0 * s1 * s1 * s1 * s1;
+            auto q2 = m4 - m3 * m3 / m2 - m2 * m2;
+            if (q2 > 0.000001 * m2 * m2) { // use quadratic fit (Cramer's rule)
+                auto c0 = s2 * s4 - s3 * s3;
+                auto c1 = s1 * s4 - s2 * s3;
+                auto c2 = s1 * s3 - s2 * s2;
+                auto det = c0 - s1 * c1 + s2 * c2;
+                if (spread) {
+                    *ys = (t0 * c0 - s1 * (t1 * s4 - t2 * s3) + s2 * (t1 * s3 - t2 * s2)) / det;
+                }
+                if (slope != nullptr) {
+                    *slope = ((t1 * s4 - t2 * s3) - t0 * c1 + s2 * (s1 * t2 - s2 * t1)) / det;
+                }
+            } else { // use linear fit
+                auto b = (t1 - s1 * t0) / m2;
+                if (spread) {
+                    *ys = t0 - b * s1;
+                }
+                if (slope != nullptr) {
+                    *slope = b;
+                }
+            }
+        }
+
+        return true;
     } else { // weighted least squares
         for (auto j = nleft; j <= nright; j++) { // make sum of w(j) == 1
             w[j - 1] /= a;
         }
 
+        if (slope != nullptr) {
+            *slope = 0.0;
+        }
+
         if (h > 0.0 && ideg > 0) { // use linear fit
             auto a = 0.0;
             for (auto j = nleft; j <= nright; j++) { // weighted center of x values
-                a += w[j - 1] * ((float) j);
+                a += w[j - 1] * x(j);
             }
             auto b = xs - a;
             auto c = 0.0;
             for (auto j = nleft; j <= nright; j++) {
-                c += w[j - 1] * pow(((float) j) - a, 2);
+                auto d = x(j) - a;
+                c += w[j - 1] * d * d;
+            }
+            // the slope only needs distinct points, while the fitted value keeps the original threshold
+            // y is centered so the rounding of the weights does not scale with its level
+            if (slope != nullptr && sqrt(c) > 0.000001 * h) {
+                auto sw = 0.0;
+                auto sy = 0.0;
+                for (auto j = nleft; j <= nright; j++) {
+                    sw += w[j - 1];
+                    sy += w[j - 1] * y[j - 1];
+                }
+                auto mean = sy / sw;
+                auto d = 0.0;
+                for (auto j = nleft; j <= nright; j++) {
+                    d += w[j - 1] * (x(j) - a) * (y[j - 1] - mean);
+                }
+                *slope = d / c;
             }
+
             if (sqrt(c) > 0.001 * range) {
                 b /= c;
 
                 // points are spread out enough to compute slope
                 for (auto j = nleft; j <= nright; j++) {
-                    w[j - 1] *= b * (((float) j) - a) + 1.0;
+                    w[j - 1] *= b * (x(j) - a) + 1.0;
                 }
             }
         }
@@ -86,24 +404,68 @@ bool est(const float* y, size_t n, size_t len, int ideg, float xs, float* ys, si
     }
 }
 
-void ess(const float* y, size_t n, size_t len, int ideg, size_t njump, bool userw, const float* rw, float* ys, float* res) {
+bool est(const float* y, size_t n, size_t len, int ideg, float xs, float* ys, size_t nleft, size_t nright, float* w, bool userw, const float* rw, float* slope = nullptr) {
+    if (ideg > 1) {
+        return userw ? est<2, true>(y, n, len, xs, ys, nleft, nright, w, rw, slope) : est<2, false>(y, n, len, xs, ys, nleft, nright, w, rw, slope);
+    } else if (ideg > 0) {
+        return userw ? est<1, true>(y, n, len, xs, ys, nleft, nright, w, rw, slope) : est<1, false>(y, n, len, xs, ys, nleft, nright, w, rw, slope);
+    } else {
+        return userw ? est<0, true>(y, n, len, xs, ys, nleft, nright, w, rw, slope) : est<0, false>(y, n, len, xs, ys, nleft, nright, w, rw, slope);
+    }
+}
+
+// slopes, if not null, gets the slope of the local fit at each point
+// kernel, if not null, has the len weights of the fit for a point at the center of its window
+// followed by the len weights of its slope, and is used in place of est for those points
+// cancel, if not null, is checked every cancel_interval points
+template <int ideg, bool userw>
+void ess(const float* y, size_t n, size_t len, size_t njump, const float* rw, float* ys, float* res, float* slopes, const float* kernel = nullptr, const CancellationToken* cancel = nullptr) {
     if (n < 2) {
         ys[0] = y[0];
+        if (slopes != nullptr) {
+            slopes[0] = 0.0;
+        }
         return;
     }
 
     size_t nleft = 0;
     size_t nright = 0;
+    size_t count = 0;
+
+    auto fit = [&](size_t i) {
+        if (cancel != nullptr && ++count % cancel_interval == 0 && cancel->cancelled()) {
+            throw CancelledError();
+        }
+
+        if (kernel != nullptr && nright - nleft + 1 == len && i - nleft == (len - 1) / 2) {
+            auto v = 0.0;
+            auto d = 0.0;
+            for (size_t k = 0; k < len; k++) {
+                v += kernel[k] * y[nleft - 1 + k];
+                d += kernel[len + k] * y[nleft - 1 + k];
+            }
+            ys[i - 1] = v;
+            if (slopes != nullptr) {
+                slopes[i - 1] = d;
+            }
+            return;
+        }
+
+        auto ok = est<ideg, userw>(y, n, len, (float) i, &ys[i - 1], nleft, nright, res, rw, slopes != nullptr ? &slopes[i - 1] : nullptr);
+        if (!ok) {
+            ys[i - 1] = y[i - 1];
+            if (slopes != nullptr) {
+                slopes[i - 1] = 0.0;
+            }
+        }
+    };
 
     auto newnj = std::min(njump, n - 1);
     if (len >= n) {
         nleft = 1;
         nright = n;
         for (size_t i = 1; i <= n; i += newnj) {
-            auto ok = est(y, n, len, ideg, (float) i, &ys[i - 1], nleft, nright, res, userw, rw);
-            if (!ok) {
-                ys[i - 1] = y[i - 1];
-            }
+            fit(i);
         }
     } else if (newnj == 1) { // newnj equal to one, len less than n
         auto nsh = (len + 1) / 2;
@@ -114,10 +476,7 @@ void ess(const float* y, size_t n, size_t len, int ideg, size_t njump, bool user
                 nleft += 1;
                 nright += 1;
             }
-            auto ok = est(y, n, len, ideg, (float) i, &ys[i - 1], nleft, nright, res, userw, rw);
-            if (!ok) {
-                ys[i - 1] = y[i - 1];
-            }
+            fit(i);
         }
     } else { // newnj greater than one, len less than n
         auto nsh = (len + 1) / 2;
@@ -132,10 +491,7 @@ void ess(const float* y, size_t n, size_t len, int ideg, size_t njump, bool user
                 nleft = i - nsh + 1;
                 nright = len + i - nsh;
             }
-            auto ok = est(y, n, len, ideg, (float) i, &ys[i - 1], nleft, nright, res, userw, rw);
-            if (!ok) {
-                ys[i - 1] = y[i - 1];
-            }
+            fit(i);
         }
     }
 
@@ -145,20 +501,136 @@ void ess(const float* y, size_t n, size_t len, int ideg, size_t njump, bool user
             for (auto j = i + 1; j <= i + newnj - 1; j++) {
                 ys[j - 1] = ys[i - 1] + delta * ((float) (j - i));
             }
+            if (slopes != nullptr) {
+                auto delta = (slopes[i + newnj - 1] - slopes[i - 1]) / ((float) newnj);
+                for (auto j = i + 1; j <= i + newnj - 1; j++) {
+                    slopes[j - 1] = slopes[i - 1] + delta * ((float) (j - i));
+                }
+            }
         }
         auto k = ((n - 1) / newnj) * newnj + 1;
         if (k != n) {
-            auto ok = est(y, n, len, ideg, (float) n, &ys[n - 1], nleft, nright, res, userw, rw);
-            if (!ok) {
-                ys[n - 1] = y[n - 1];
-            }
+            fit(n);
             if (k != n - 1) {
                 auto delta = (ys[n - 1] - ys[k - 1]) / ((float) (n - k));
                 for (auto j = k + 1; j <= n - 1; j++) {
                     ys[j - 1] = ys[k - 1] + delta * ((float) (j - k));
                 }
+                if (slopes != nullptr) {
+                    auto delta = (slopes[n - 1] - slopes[k - 1]) / ((float) (n - k));
+                    for (auto j = k + 1; j <= n - 1; j++) {
+                        slopes[j - 1] = slopes[k - 1] + delta * ((float) (j - k));
+                    }
+                }
+            }
+        }
+    }
+}
+
+// chooses the specialization once per call instead of once per point
+void ess(const float* y, size_t n, size_t len, int ideg, size_t njump, bool userw, const float* rw, float* ys, float* res, float* slopes = nullptr, const float* kernel = nullptr, const CancellationToken* cancel = nullptr) {
+    if (ideg > 1) {
+        if (userw) {
+            ess<2, true>(y, n, len, njump, rw, ys, res, slopes, kernel, cancel);
+        } else {
+            ess<2, false>(y, n, len, njump, rw, ys, res, slopes, kernel, cancel);
+        }
+    } else if (ideg > 0) {
+        if (userw) {
+            ess<1, true>(y, n, len, njump, rw, ys, res, slopes, kernel, cancel);
+        } else {
+            ess<1, false>(y, n, len, njump, rw, ys, res, slopes, kernel, cancel);
+        }
+    } else {
+        if (userw) {
+            ess<0, true>(y, n, len, njump, rw, ys, res, slopes, kernel, cancel);
+        } else {
+            ess<0, false>(y, n, len, njump, rw, ys, res, slopes, kernel, cancel);
+        }
+    }
+}
+
+// smooths y at sorted x-values, which do not need to be evenly spaced
+// each fit uses the len points nearest to x[i], found by sliding the window forward
+// points skipped by njump are interpolated linearly in x
+template <int ideg, bool userw>
+void ess(const float* x, const float* y, size_t n, size_t len, size_t njump, const float* rw, float* ys, float* res, float* slopes) {
+    if (n < 2) {
+        ys[0] = y[0];
+        if (slopes != nullptr) {
+            slopes[0] = 0.0;
+        }
+        return;
+    }
+
+    auto positions = SortedPositions{x};
+    size_t nleft = 1;
+    size_t nright = std::min(len, n);
+
+    auto fit = [&](size_t i) {
+        while (nright < n && x[nright] - x[i - 1] < x[i - 1] - x[nleft - 1]) {
+            nleft += 1;
+            nright += 1;
+        }
+        auto ok = est<ideg, userw>(y, n, len, x[i - 1], &ys[i - 1], nleft, nright, res, rw, slopes != nullptr ? &slopes[i - 1] : nullptr, positions);
+        if (!ok) {
+            ys[i - 1] = y[i - 1];
+            if (slopes != nullptr) {
+                slopes[i - 1] = 0.0;
+            }
+        }
+    };
+
+    auto interpolate = [&](float* v, size_t i, size_t k) {
+        auto dx = x[k - 1] - x[i - 1];
+        auto delta = dx > 0.0 ? (v[k - 1] - v[i - 1]) / dx : 0.0;
+        for (auto j = i + 1; j <= k - 1; j++) {
+            v[j - 1] = v[i - 1] + delta * (x[j - 1] - x[i - 1]);
+        }
+    };
+
+    auto newnj = std::min(njump, n - 1);
+    for (size_t i = 1; i <= n; i += newnj) {
+        fit(i);
+    }
+
+    if (newnj != 1) {
+        for (size_t i = 1; i <= n - newnj; i += newnj) {
+            interpolate(ys, i, i + newnj);
+            if (slopes != nullptr) {
+                interpolate(slopes, i, i + newnj);
             }
         }
+        auto k = ((n - 1) / newnj) * newnj + 1;
+        if (k != n) {
+            fit(n);
+            interpolate(ys, k, n);
+            if (slopes != nullptr) {
+                interpolate(slopes, k, n);
+            }
+        }
+    }
+}
+
+void ess(const float* x, const float* y, size_t n, size_t len, int ideg, size_t njump, bool userw, const float* rw, float* ys, float* res, float* slopes = nullptr) {
+    if (ideg > 1) {
+        if (userw) {
+            ess<2, true>(x, y, n, len, njump, rw, ys, res, slopes);
+        } else {
+            ess<2, false>(x, y, n, len, njump, rw, ys, res, slopes);
+        }
+    } else if (ideg > 0) {
+        if (userw) {
+            ess<1, true>(x, y, n, len, njump, rw, ys, res, slopes);
+        } else {
+            ess<1, false>(x, y, n, len, njump, rw, ys, res, slopes);
+        }
+    } else {
+        if (userw) {
+            ess<0, true>(x, y, n, len, njump, rw, ys, res, slopes);
+        } else {
+            ess<0, false>(x, y, n, len, njump, rw, ys, res, slopes);
+        }
     }
 }
 
@@ -186,52 +658,127 @@ void ma(const float* x, size_t n, size_t len, float* ave) {
     }
 }
 
+// same as ma(np), ma(np), and ma(3) in a single pass
+// work holds the last np values of the first average
 void fts(const float* x, size_t n, size_t np, float* trend, float* work) {
-    ma(x, n, np, trend);
-    ma(trend, n - np + 1, np, work);
-    ma(work, n - 2 * np + 2, 3, trend);
+    auto flen = (float) np;
+    auto v1 = 0.0;
+    auto v2 = 0.0;
+    auto v3 = 0.0;
+
+    // get the first average
+    for (size_t i = 0; i < np; i++) {
+        v1 += x[i];
+    }
+
+    // fill the window of the second average
+    for (size_t i = 0; i < np; i++) {
+        if (i > 0) {
+            v1 = v1 - x[i - 1] + x[i + np - 1];
+        }
+        work[i] = v1 / flen;
+        v2 += work[i];
+    }
+
+    // fill the window of the third average
+    float a0 = v2 / flen;
+    float a1 = 0.0;
+    float a2 = 0.0;
+    size_t m = 0;
+    for (size_t i = np; i < np + 2; i++) {
+        v1 = v1 - x[i - 1] + x[i + np - 1];
+        float ave1 = v1 / flen;
+        v2 = v2 - work[m] + ave1;
+        work[m] = ave1;
+        m += 1;
+        if (i == np) {
+            a1 = v2 / flen;
+        } else {
+            a2 = v2 / flen;
+        }
+    }
+    v3 = ((v3 + a0) + a1) + a2;
+    trend[0] = v3 / 3.0f;
+
+    // window down the array
+    auto newn = n - 2 * np;
+    for (size_t j = 1; j < newn; j++) {
+        auto i = j + np + 1;
+        v1 = v1 - x[i - 1] + x[i + np - 1];
+        float ave1 = v1 / flen;
+        if (m == np) {
+            m = 0;
+        }
+        v2 = v2 - work[m] + ave1;
+        work[m] = ave1;
+        m += 1;
+        float ave2 = v2 / flen;
+        v3 = v3 - a0 + ave2;
+        a0 = a1;
+        a1 = a2;
+        a2 = ave2;
+        trend[j] = v3 / 3.0f;
+    }
 }
 
-void rwts(const float* y, size_t n, const float* fit, float* rw) {
+// the fit is season + trend
+void rwts(const float* y, size_t n, const float* season, const float* trend, float* rw) {
     for (size_t i = 0; i < n; i++) {
-        rw[i] = fabs(y[i] - fit[i]);
+        rw[i] = fabs(y[i] - (trend[i] + season[i]));
     }
 
     auto mid1 = (n - 1) / 2;
     auto mid2 = n / 2;
 
-    // sort
-    std::sort(rw, rw + n);
+    // partial sort
+    std::nth_element(rw, rw + mid2, rw + n);
+    if (mid1 != mid2) {
+        rw[mid1] = *std::max_element(rw, rw + mid2);
+    }
 
     auto cmad = 3.0 * (rw[mid1] + rw[mid2]); // 6 * median abs resid
     auto c9 = 0.999 * cmad;
     auto c1 = 0.001 * cmad;
 
     for (size_t i = 0; i < n; i++) {
-        auto r = fabs(y[i] - fit[i]);
+        auto r = fabs(y[i] - (trend[i] + season[i]));
         if (r <= c1) {
             rw[i] = 1.0;
         } else if (r <= c9) {
-            rw[i] = pow(1.0 - pow(r / cmad, 2), 2);
+            auto q = r / cmad;
+            auto t = 1.0 - q * q;
+            rw[i] = t * t;
         } else {
             rw[i] = 0.0;
         }
     }
 }
 
-void ss(const float* y, size_t n, size_t np, size_t ns, int isdeg, size_t nsjump, bool userw, float* rw, float* season, float* work1, float* work2, float* work3, float* work4) {
-    for (size_t j = 1; j <= np; j++) {
+// series shorter than this smooth their subseries on one thread
+const size_t parallel_min_size = 1 << 16;
+
+// values per task when the subseries are split across an executor
+const size_t parallel_task_size = 1 << 14;
+
+// smooths the cycle-subseries of y - trend
+// executor, if not null, smooths the subseries of large series in parallel
+void ss(const float* y, const float* trend, size_t n, size_t np, size_t ns, int isdeg, size_t nsjump, bool userw, float* rw, float* season, float* work1, float* work2, float* work3, float* work4, const CancellationToken* cancel = nullptr, Executor* executor = nullptr) {
+    auto smooth = [&](size_t j, float* work1, float* work2, float* work3, float* work4) {
+        if (cancel != nullptr && cancel->cancelled()) {
+            throw CancelledError();
+        }
+
         size_t k = (n - j) / np + 1;
 
         for (size_t i = 1; i <= k; i++) {
-            work1[i - 1] = y[(i - 1) * np + j - 1];
+            work1[i - 1] = y[(i - 1) * np + j - 1] - trend[(i - 1) * np + j - 1];
         }
         if (userw) {
             for (size_t i = 1; i <= k; i++) {
                 work3[i - 1] = rw[(i - 1) * np + j - 1];
             }
         }
-        ess(work1, k, ns, isdeg, nsjump, userw, work3, work2 + 1, work4);
+        ess(work1, k, ns, isdeg, nsjump, userw, work3, work2 + 1, work4, nullptr, nullptr, cancel);
         auto xs = 0.0;
         auto nright = std::min(ns, k);
         auto ok = est(work1, k, ns, isdeg, xs, &work2[0], 1, nright, work4, userw, work3);
@@ -247,29 +794,90 @@ void ss(const float* y, size_t n, size_t np, size_t ns, int isdeg, size_t nsjump
         for (size_t m = 1; m <= k + 2; m++) {
             season[(m - 1) * np + j - 1] = work2[m - 1];
         }
+    };
+
+    // the subseries are independent, so each task smooths a contiguous range of them with its own scratch
+    // the ranges depend only on the series, so the work is split the same way for any number of threads
+    auto tasks = executor != nullptr && n >= parallel_min_size ? std::min(np, n / parallel_task_size) : 1;
+    if (tasks > 1) {
+        auto stride = ((n - 1) / np + 3 + 15) / 16 * 16;
+        auto workers = std::min(concurrency(*executor), tasks);
+        std::vector<std::vector<float>> scratch(workers);
+        parallel_for(tasks, workers, *executor, [&](size_t slot, size_t t) {
+            auto& w = scratch[slot];
+            w.resize(4 * stride);
+            for (auto j = t * np / tasks + 1; j <= (t + 1) * np / tasks; j++) {
+                smooth(j, w.data(), w.data() + stride, w.data() + 2 * stride, w.data() + 3 * stride);
+            }
+        });
+        return;
+    }
+
+    for (size_t j = 1; j <= np; j++) {
+        smooth(j, work1, work2, work3, work4);
     }
 }
 
-void onestp(const float* y, size_t n, size_t np, size_t ns, size_t nt, size_t nl, int isdeg, int itdeg, int ildeg, size_t nsjump, size_t ntjump, size_t nljump, size_t ni, bool userw, float* rw, float* season, float* trend, float* work1, float* work2, float* work3, float* work4, float* work5) {
+// slope, if not null, gets the slope of the trend from the last inner loop
+void onestp(const float* y, size_t n, size_t np, size_t ns, size_t nt, size_t nl, int isdeg, int itdeg, int ildeg, size_t nsjump, size_t ntjump, size_t nljump, size_t ni, bool userw, float* rw, float* season, float* trend, float* work1, float* work2, float* work3, float* work4, float* work5, float* slope = nullptr, const CancellationToken* cancel = nullptr, Executor* executor = nullptr) {
     for (size_t j = 0; j < ni; j++) {
-        for (size_t i = 0; i < n; i++) {
-            work1[i] = y[i] - trend[i];
-        }
-
-        ss(work1, n, np, ns, isdeg, nsjump, userw, rw, work2, work3, work4, work5, season);
+        ss(y, trend, n, np, ns, isdeg, nsjump, userw, rw, work2, work3, work4, work5, season, cancel, executor);
         fts(work2, n + 2 * np, np, work3, work1);
-        ess(work3, n, nl, ildeg, nljump, false, work4, work1, work5);
+        ess(work3, n, nl, ildeg, nljump, false, work4, work1, work5, nullptr, nullptr, cancel);
         for (size_t i = 0; i < n; i++) {
             season[i] = work2[np + i] - work1[i];
-        }
-        for (size_t i = 0; i < n; i++) {
             work1[i] = y[i] - season[i];
         }
-        ess(work1, n, nt, itdeg, ntjump, userw, rw, trend, work3);
+        ess(work1, n, nt, itdeg, ntjump, userw, rw, trend, work3, j + 1 == ni ? slope : nullptr, nullptr, cancel);
     }
 }
 
-void stl(const float* y, size_t n, size_t np, size_t ns, size_t nt, size_t nl, int isdeg, int itdeg, int ildeg, size_t nsjump, size_t ntjump, size_t nljump, size_t ni, size_t no, float* rw, float* season, float* trend) {
+// each work array is padded to a multiple of 64 bytes
+constexpr size_t work_stride(size_t n, size_t np) {
+    return (n + 2 * np + 15) / 16 * 16;
+}
+
+// number of floats needed for the work arrays of stl()
+constexpr size_t work_size(size_t n, size_t np) {
+    return 5 * work_stride(n, np);
+}
+
+// a single 64-byte aligned block that can be reused across fits
+template <typename Allocator = std::allocator<float>>
+class Workspace {
+    std::vector<float, Allocator> data_;
+
+public:
+    explicit Workspace(const Allocator& alloc = Allocator()) : data_(alloc) {}
+
+    inline float* reserve(size_t size) {
+        if (data_.size() < size + 16) {
+            data_.resize(size + 16);
+        }
+        void* ptr = data_.data();
+        auto space = data_.size() * sizeof(float);
+        return static_cast<float*>(std::align(64, size * sizeof(float), ptr, space));
+    }
+};
+
+// limits and callbacks for stl(), checked after each inner loop
+// the fit stops early when the next inner loop would end past the deadline, assuming it takes as long as the last one
+struct StlControl {
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    size_t max_iterations = std::numeric_limits<size_t>::max();
+    // also checked within the smoothers, and throws CancelledError
+    const CancellationToken* cancel = nullptr;
+    // called after each inner loop with the inner loops completed and the total
+    std::function<void(size_t, size_t)> progress;
+    // splits the seasonal smoothing of large series
+    Executor* executor = nullptr;
+};
+
+// work must have room for work_size(n, np) floats and be 64-byte aligned for best performance
+// trend must be zero on entry
+// slope, if not null, gets the slope of the final trend
+// returns the number of inner loops completed, which is less than ni * (no + 1) when a limit is reached
+size_t stl(const float* y, size_t n, size_t np, size_t ns, size_t nt, size_t nl, int isdeg, int itdeg, int ildeg, size_t nsjump, size_t ntjump, size_t nljump, size_t ni, size_t no, float* rw, float* season, float* trend, float* work, float* slope = nullptr, const StlControl* control = nullptr) {
     if (ns < 3) {
         throw std::invalid_argument("seasonal_length must be at least 3");
     }
@@ -283,14 +891,14 @@ void stl(const float* y, size_t n, size_t np, size_t ns, size_t nt, size_t nl, i
         throw std::invalid_argument("period must be at least 2");
     }
 
-    if (isdeg != 0 && isdeg != 1) {
-        throw std::invalid_argument("seasonal_degree must be 0 or 1");
+    if (isdeg < 0 || isdeg > 2) {
+        throw std::invalid_argument("seasonal_degree must be 0, 1, or 2");
     }
-    if (itdeg != 0 && itdeg != 1) {
-        throw std::invalid_argument("trend_degree must be 0 or 1");
+    if (itdeg < 0 || itdeg > 2) {
+        throw std::invalid_argument("trend_degree must be 0, 1, or 2");
     }
-    if (ildeg != 0 && ildeg != 1) {
-        throw std::invalid_argument("low_pass_degree must be 0 or 1");
+    if (ildeg < 0 || ildeg > 2) {
+        throw std::invalid_argument("low_pass_degree must be 0, 1, or 2");
     }
 
     if (ns % 2 != 1) {
@@ -303,83 +911,355 @@ void stl(const float* y, size_t n, size_t np, size_t ns, size_t nt, size_t nl, i
         throw std::invalid_argument("low_pass_length must be odd");
     }
 
-    auto work1 = std::vector<float>(n + 2 * np);
-    auto work2 = std::vector<float>(n + 2 * np);
-    auto work3 = std::vector<float>(n + 2 * np);
-    auto work4 = std::vector<float>(n + 2 * np);
-    auto work5 = std::vector<float>(n + 2 * np);
+    auto stride = work_stride(n, np);
+    auto work1 = work;
+    auto work2 = work1 + stride;
+    auto work3 = work2 + stride;
+    auto work4 = work3 + stride;
+    auto work5 = work4 + stride;
 
     auto userw = false;
+    auto stop = false;
+    size_t iterations = 0;
     size_t k = 0;
 
     while (true) {
-        onestp(y, n, np, ns, nt, nl, isdeg, itdeg, ildeg, nsjump, ntjump, nljump, ni, userw, rw, season, trend, work1.data(), work2.data(), work3.data(), work4.data(), work5.data());
+        if (control == nullptr) {
+            onestp(y, n, np, ns, nt, nl, isdeg, itdeg, ildeg, nsjump, ntjump, nljump, ni, userw, rw, season, trend, work1, work2, work3, work4, work5, k == no ? slope : nullptr);
+            iterations += ni;
+        } else {
+            // one inner loop at a time, so the components are complete whenever the fit stops
+            for (size_t j = 0; j < ni && !stop; j++) {
+                auto start = std::chrono::steady_clock::now();
+                onestp(y, n, np, ns, nt, nl, isdeg, itdeg, ildeg, nsjump, ntjump, nljump, 1, userw, rw, season, trend, work1, work2, work3, work4, work5, slope, control->cancel, control->executor);
+                iterations += 1;
+                if (control->progress) {
+                    control->progress(iterations, ni * (no + 1));
+                }
+                if (control->cancel != nullptr && control->cancel->cancelled()) {
+                    throw CancelledError();
+                }
+                auto now = std::chrono::steady_clock::now();
+                stop = iterations >= control->max_iterations || control->deadline - now <= now - start;
+            }
+        }
         k += 1;
-        if (k > no) {
+        if (k > no || stop) {
             break;
         }
-        for (size_t i = 0; i < n; i++) {
-            work1[i] = trend[i] + season[i];
-        }
-        rwts(y, n, work1.data(), rw);
+        rwts(y, n, season, trend, rw);
         userw = true;
     }
 
-    if (no <= 0) {
+    // weights are the ones used by the last inner loop
+    if (!userw) {
         for (size_t i = 0; i < n; i++) {
             rw[i] = 1.0;
         }
     }
+
+    return iterations;
+}
+
+void stl(const float* y, size_t n, size_t np, size_t ns, size_t nt, size_t nl, int isdeg, int itdeg, int ildeg, size_t nsjump, size_t ntjump, size_t nljump, size_t ni, size_t no, float* rw, float* season, float* trend) {
+    Workspace<> workspace;
+    auto work = workspace.reserve(work_size(n, np));
+    stl(y, n, np, ns, nt, nl, isdeg, itdeg, ildeg, nsjump, ntjump, nljump, ni, no, rw, season, trend, work);
+}
+
+// one-pass variance from sums of shifted values
+// the shift keeps the sums small when the mean is large compared to the spread
+class Variance {
+    double shift_;
+    double sum_ = 0.0;
+    double sum2_ = 0.0;
+
+public:
+    explicit Variance(double shift) : shift_(shift) {}
+
+    inline void add(double v) {
+        auto d = v - shift_;
+        sum_ += d;
+        sum2_ += d * d;
+    }
+
+    inline double value(size_t n) const {
+        return (sum2_ - sum_ * sum_ / n) / (n - 1);
+    }
+};
+
+float var(const float* series, size_t n) {
+    auto v = Variance(series[0]);
+    for (size_t i = 0; i < n; i++) {
+        v.add(series[i]);
+    }
+    return v.value(n);
 }
 
 float var(const std::vector<float>& series) {
-    auto mean = std::accumulate(series.begin(), series.end(), 0.0) / series.size();
-    std::vector<float> tmp;
-    tmp.reserve(series.size());
-    for (auto v : series) {
-        tmp.push_back(pow(v - mean, 2));
+    return var(series.data(), series.size());
+}
+
+float strength(const float* component, const float* remainder, size_t n) {
+    auto vr = Variance(remainder[0]);
+    auto vsr = Variance(component[0] + remainder[0]);
+    for (size_t i = 0; i < n; i++) {
+        vr.add(remainder[i]);
+        vsr.add(component[i] + remainder[i]);
     }
-    return std::accumulate(tmp.begin(), tmp.end(), 0.0) / (series.size() - 1);
+    return std::max(0.0, 1.0 - vr.value(n) / vsr.value(n));
 }
 
 float strength(const std::vector<float>& component, const std::vector<float>& remainder) {
-    std::vector<float> sr;
-    sr.reserve(remainder.size());
-    for (size_t i = 0; i < remainder.size(); i++) {
-        sr.push_back(component[i] + remainder[i]);
-    }
-    return std::max(0.0, 1.0 - var(remainder) / var(sr));
+    return strength(component.data(), remainder.data(), remainder.size());
 }
 
-class StlResult {
+struct StlStrength {
+    float seasonal;
+    float trend;
+    float remainder_variance;
+};
+
+// accumulates the variances for both strengths in a single pass
+class StrengthAccumulator {
+    Variance vr_;
+    Variance vsr_;
+    Variance vtr_;
+
 public:
-    std::vector<float> seasonal;
-    std::vector<float> trend;
-    std::vector<float> remainder;
-    std::vector<float> weights;
+    StrengthAccumulator(float seasonal, float trend, float remainder) : vr_(remainder), vsr_(seasonal + remainder), vtr_(trend + remainder) {}
 
-    inline float seasonal_strength() {
-        return strength(seasonal, remainder);
+    inline void add(float seasonal, float trend, float remainder) {
+        vr_.add(remainder);
+        vsr_.add(seasonal + remainder);
+        vtr_.add(trend + remainder);
     }
 
-    inline float trend_strength() {
-        return strength(trend, remainder);
+    inline StlStrength value(size_t n) const {
+        auto r = vr_.value(n);
+        return StlStrength {
+            (float) std::max(0.0, 1.0 - r / vsr_.value(n)),
+            (float) std::max(0.0, 1.0 - r / vtr_.value(n)),
+            (float) r
+        };
     }
 };
 
-class StlParams {
-    std::optional<size_t> ns_ = std::nullopt;
-    std::optional<size_t> nt_ = std::nullopt;
-    std::optional<size_t> nl_ = std::nullopt;
-    int isdeg_ = 0;
-    int itdeg_ = 1;
-    std::optional<int> ildeg_ = std::nullopt;
-    std::optional<size_t> nsjump_ = std::nullopt;
-    std::optional<size_t> ntjump_ = std::nullopt;
-    std::optional<size_t> nljump_ = std::nullopt;
-    std::optional<size_t> ni_ = std::nullopt;
+// seasonal and trend strength without allocating
+StlStrength strengths(const float* seasonal, const float* trend, const float* remainder, size_t n) {
+    auto acc = StrengthAccumulator(seasonal[0], trend[0], remainder[0]);
+    for (size_t i = 0; i < n; i++) {
+        acc.add(seasonal[i], trend[i], remainder[i]);
+    }
+    return acc.value(n);
+}
+
+// estimates both strengths from a classical decomposition instead of a full fit
+// the trend is a centered moving average and the seasonal component is the
+// mean of each cycle-subseries, so it is meant for screening many series
+// the first and last period / 2 values are not used
+StlStrength estimate_strengths(const float* y, size_t n, size_t np) {
+    if (np < 2) {
+        throw std::invalid_argument("period must be at least 2");
+    }
+    if (n < 2 * np) {
+        throw std::invalid_argument("series has less than two periods");
+    }
+
+    // sums for each cycle-subseries of the detrended series d and of y
+    // y is shifted by its first value for accuracy
+    struct Sums {
+        size_t count = 0;
+        double d = 0.0;
+        double dd = 0.0;
+        double y = 0.0;
+        double yy = 0.0;
+    };
+    std::vector<Sums> sums(np);
+
+    auto h = np / 2;
+    auto even = np % 2 == 0;
+    auto shift = (double) y[0];
+    auto v = 0.0;
+    for (size_t i = 0; i < 2 * h + 1; i++) {
+        v += y[i];
+    }
+
+    auto p = h;
+    for (size_t i = h; i < n - h; i++) {
+        if (i > h) {
+            v += (double) y[i + h] - (double) y[i - h - 1];
+        }
+        auto trend = even ? (v - 0.5 * (y[i - h] + y[i + h])) / np : v / np;
+        auto d = y[i] - trend;
+        auto yi = y[i] - shift;
+        auto& sum = sums[p];
+        p = p + 1 == np ? 0 : p + 1;
+        sum.count += 1;
+        sum.d += d;
+        sum.dd += d * d;
+        sum.y += yi;
+        sum.yy += yi * yi;
+    }
+
+    // seasonal component is centered to sum to zero over a cycle
+    auto center = 0.0;
+    for (auto& sum : sums) {
+        center += sum.d / sum.count;
+    }
+    center /= np;
+
+    double sd = 0.0;
+    double sdd = 0.0;
+    double sr = 0.0;
+    double srr = 0.0;
+    double st = 0.0;
+    double stt = 0.0;
+    for (auto& sum : sums) {
+        auto c = (double) sum.count;
+        auto seasonal = sum.d / c - center;
+        sd += sum.d;
+        sdd += sum.dd;
+        sr += sum.d - c * seasonal;
+        srr += sum.dd - 2.0 * seasonal * sum.d + c * seasonal * seasonal;
+        st += sum.y - c * seasonal;
+        stt += sum.yy - 2.0 * seasonal * sum.y + c * seasonal * seasonal;
+    }
+
+    auto m = (double) (n - 2 * h);
+    auto vr = (srr - sr * sr / m) / (m - 1);
+    auto vsr = (sdd - sd * sd / m) / (m - 1);
+    auto vtr = (stt - st * st / m) / (m - 1);
+    return StlStrength {
+        (float) std::max(0.0, 1.0 - vr / vsr),
+        (float) std::max(0.0, 1.0 - vr / vtr),
+        (float) vr
+    };
+}
+
+StlStrength estimate_strengths(const std::vector<float>& y, size_t np) {
+    return estimate_strengths(y.data(), y.size(), np);
+}
+
+template <typename Allocator = std::allocator<float>>
+class BasicStlResult {
+public:
+    std::vector<float, Allocator> seasonal;
+    std::vector<float, Allocator> trend;
+    std::vector<float, Allocator> remainder;
+    std::vector<float, Allocator> weights;
+
+    inline float seasonal_strength() {
+        return strength(seasonal.data(), remainder.data(), remainder.size());
+    }
+
+    inline float trend_strength() {
+        return strength(trend.data(), remainder.data(), remainder.size());
+    }
+
+    inline StlStrength strengths() {
+        return stl::strengths(seasonal.data(), trend.data(), remainder.data(), remainder.size());
+    }
+};
+
+using StlResult = BasicStlResult<>;
+
+struct PeriodCandidate {
+    size_t period;
+    float score;
+};
+
+// enough of a fit to forecast from
+class StlModel {
+public:
+    // the last cycle of the seasonal component
+    std::vector<float> seasonal;
+    // the trend at the last value and its slope, from a local fit to the end of the seasonally adjusted series
+    float level = 0.0;
+    float slope = 0.0;
+
+    // forecast[i] is the prediction i + 1 steps past the end of the series
+    // without a seasonal cycle, it is the level and slope alone
+    inline void forecast(size_t h, float* forecast) const {
+        auto np = seasonal.size();
+        size_t p = 0;
+        for (size_t i = 0; i < h; i++) {
+            forecast[i] = level + slope * (float) (i + 1);
+            if (np > 0) {
+                forecast[i] += seasonal[p];
+                p = p + 1 == np ? 0 : p + 1;
+            }
+        }
+    }
+
+    inline std::vector<float> forecast(size_t h) const {
+        std::vector<float> res(h);
+        forecast(h, res.data());
+        return res;
+    }
+};
+
+// where to write each component, with room for n values, or null to skip it
+struct StlOutput {
+    float* seasonal = nullptr;
+    float* trend = nullptr;
+    float* remainder = nullptr;
+    float* weights = nullptr;
+    float* seasonally_adjusted = nullptr;
+    StlStrength* strength = nullptr;
+    // robust z-scores of the remainder, using the median and MAD
+    float* anomaly_scores = nullptr;
+    // true where the score is beyond the anomaly threshold
+    bool* anomalies = nullptr;
+    StlModel* model = nullptr;
+    // slope of the trend from the final local fits, interpolated like the trend
+    float* trend_slope = nullptr;
+    // inner loops completed, which can be fewer than requested with a time or iteration limit
+    size_t* iterations = nullptr;
+};
+
+// a series stored with a fixed distance between elements, like a column of a row-major matrix
+template <typename T>
+class StridedView {
+    const T* data_;
+    size_t size_;
+    size_t stride_;
+
+public:
+    StridedView(const T* data, size_t size, size_t stride) : data_(data), size_(size), stride_(stride) {}
+
+    inline size_t size() const {
+        return size_;
+    }
+
+    inline const T& operator[](size_t i) const {
+        return data_[i * stride_];
+    }
+};
+
+#ifdef STL_COROUTINES
+class FitAwaitable;
+#endif
+
+class StlParams {
+    std::optional<size_t> ns_ = std::nullopt;
+    std::optional<size_t> nt_ = std::nullopt;
+    std::optional<size_t> nl_ = std::nullopt;
+    int isdeg_ = 0;
+    int itdeg_ = 1;
+    std::optional<int> ildeg_ = std::nullopt;
+    std::optional<size_t> nsjump_ = std::nullopt;
+    std::optional<size_t> ntjump_ = std::nullopt;
+    std::optional<size_t> nljump_ = std::nullopt;
+    std::optional<size_t> ni_ = std::nullopt;
     std::optional<size_t> no_ = std::nullopt;
     bool robust_ = false;
+    float anomaly_threshold_ = 3.5;
+    std::optional<std::chrono::nanoseconds> time_limit_ = std::nullopt;
+    std::optional<size_t> iteration_limit_ = std::nullopt;
+    const CancellationToken* cancel_ = nullptr;
+    std::function<void(size_t, size_t)> progress_;
+    Executor* executor_ = nullptr;
 
 public:
     inline StlParams seasonal_length(size_t ns) {
@@ -442,8 +1322,94 @@ public:
         return *this;
     }
 
+    inline StlParams anomaly_threshold(float threshold) {
+        this->anomaly_threshold_ = threshold;
+        return *this;
+    }
+
+    // stops when another inner loop would not finish within the limit, but always completes one
+    // the components are from the last completed inner loop
+    inline StlParams time_limit(std::chrono::nanoseconds limit) {
+        this->time_limit_ = limit;
+        return *this;
+    }
+
+    // stops after this many inner loops in total, across all outer loops
+    inline StlParams iteration_limit(size_t limit) {
+        this->iteration_limit_ = limit;
+        return *this;
+    }
+
+    // fits throw CancelledError soon after the token is cancelled
+    // the token must outlive the fits that use it
+    inline StlParams cancellation_token(const CancellationToken& token) {
+        this->cancel_ = &token;
+        return *this;
+    }
+
+    // called after each inner loop with the inner loops completed and the total
+    inline StlParams progress(std::function<void(size_t, size_t)> callback) {
+        this->progress_ = std::move(callback);
+        return *this;
+    }
+
+    // smooths the subseries of large series on the executor, which must outlive the fits that use it
+    inline StlParams executor(Executor& executor) {
+        this->executor_ = &executor;
+        return *this;
+    }
+
     StlResult fit(const float* y, size_t n, size_t np);
     StlResult fit(const std::vector<float>& y, size_t np);
+
+    // allocates the result and the workspace with alloc
+    template <typename Allocator>
+    BasicStlResult<Allocator> fit(const float* y, size_t n, size_t np, const Allocator& alloc);
+
+    // any range with size() and operator[], like StridedView or std::vector<double>
+    template <typename Range>
+    StlResult fit(const Range& y, size_t np);
+
+    // only writes the requested components
+    void fit(const float* y, size_t n, size_t np, const StlOutput& output);
+
+    // reuses the workspace between fits
+    void fit(const float* y, size_t n, size_t np, const StlOutput& output, Workspace<>& workspace);
+
+    // fits on the executor without blocking
+    // y and the output buffers must stay valid until the future is ready
+    std::future<void> fit_async(const float* y, size_t n, size_t np, const StlOutput& output, Executor& executor = default_executor());
+
+#ifdef STL_COROUTINES
+    // co_await fits on the executor and resumes the coroutine there
+    FitAwaitable fit_awaitable(const float* y, size_t n, size_t np, const StlOutput& output, Executor& executor = default_executor());
+#endif
+
+    // fits each series on the executor, with small series grouped into larger tasks
+    // large series also smooth their subseries in parallel
+    std::vector<StlResult> batch(const std::vector<std::vector<float>>& series, size_t np, Executor& executor = default_executor());
+
+    // seasonal strength for each period, in the same order
+    // best gets the decomposition for the period with the highest strength
+    std::vector<PeriodCandidate> scan(const float* y, size_t n, const std::vector<size_t>& periods, StlResult* best = nullptr);
+    std::vector<PeriodCandidate> scan(const std::vector<float>& y, const std::vector<size_t>& periods, StlResult* best = nullptr);
+
+    // strength of each window of the series, with windows starting every step values
+    // with warm_start, each window starts from the trend of the previous one and runs one inner loop fewer
+    std::vector<StlStrength> rolling(const float* y, size_t n, size_t np, size_t window, size_t step, bool warm_start = true, Executor& executor = default_executor());
+    std::vector<StlStrength> rolling(const std::vector<float>& y, size_t np, size_t window, size_t step, bool warm_start = true, Executor& executor = default_executor());
+
+private:
+    template <typename Allocator>
+    BasicStlResult<Allocator> fit(const float* y, size_t n, size_t np, const Allocator& alloc, float* work);
+
+    // when warm is true, output.trend holds the starting trend instead of zero
+    void fit(const float* y, size_t n, size_t np, const StlOutput& output, float* work, bool warm = false);
+
+    size_t work_size(size_t n, size_t np) const;
+
+    // model, if not null, gets the level and slope of the trend at the end
+    size_t decompose(const float* y, size_t n, size_t np, float* seasonal, float* trend, float* weights, float* work, float* slope, StlModel* model = nullptr) const;
 };
 
 StlParams params() {
@@ -451,22 +1417,18 @@ StlParams params() {
 }
 
 StlResult StlParams::fit(const float* y, size_t n, size_t np) {
-    if (n < 2 * np) {
-        throw std::invalid_argument("series has less than two periods");
-    }
+    return StlParams::fit(y, n, np, std::allocator<float>());
+}
+
+size_t StlParams::decompose(const float* y, size_t n, size_t np, float* seasonal, float* trend, float* weights, float* work, float* slope, StlModel* model) const {
+    // the time limit includes the setup
+    auto start = std::chrono::steady_clock::now();
 
     auto ns = this->ns_.value_or(np);
 
     auto isdeg = this->isdeg_;
     auto itdeg = this->itdeg_;
 
-    auto res = StlResult {
-        std::vector<float>(n),
-        std::vector<float>(n),
-        std::vector<float>(),
-        std::vector<float>(n)
-    };
-
     auto ildeg = this->ildeg_.value_or(itdeg);
     auto newns = std::max(ns, (size_t) 3);
     if (newns % 2 == 0) {
@@ -493,18 +1455,738 @@ StlResult StlParams::fit(const float* y, size_t n, size_t np) {
     auto ntjump = this->ntjump_.value_or((size_t) ceil(((float) nt) / 10.0));
     auto nljump = this->nljump_.value_or((size_t) ceil(((float) nl) / 10.0));
 
-    stl(y, n, newnp, newns, nt, nl, isdeg, itdeg, ildeg, nsjump, ntjump, nljump, ni, no, res.weights.data(), res.seasonal.data(), res.trend.data());
+    size_t iterations = 0;
+    if (!this->time_limit_.has_value() && !this->iteration_limit_.has_value() && this->cancel_ == nullptr && !this->progress_ && this->executor_ == nullptr) {
+        iterations = stl(y, n, newnp, newns, nt, nl, isdeg, itdeg, ildeg, nsjump, ntjump, nljump, ni, no, weights, seasonal, trend, work, slope);
+    } else {
+        if (this->iteration_limit_.has_value() && *this->iteration_limit_ < 1) {
+            throw std::invalid_argument("iteration_limit must be at least 1");
+        }
 
-    res.remainder.reserve(n);
-    for (size_t i = 0; i < n; i++) {
-        res.remainder.push_back(y[i] - res.seasonal[i] - res.trend[i]);
+        StlControl control;
+        if (this->time_limit_.has_value()) {
+            control.deadline = start + *this->time_limit_;
+        }
+        if (this->iteration_limit_.has_value()) {
+            control.max_iterations = *this->iteration_limit_;
+        }
+        control.cancel = this->cancel_;
+        control.progress = this->progress_;
+        control.executor = this->executor_;
+        iterations = stl(y, n, newnp, newns, nt, nl, isdeg, itdeg, ildeg, nsjump, ntjump, nljump, ni, no, weights, seasonal, trend, work, slope, &control);
+    }
+
+    if (model != nullptr) {
+        // refit the end of the seasonally adjusted series on its own, so the local fit is linear
+        // for long series, the trend itself falls back to a local mean near the ends
+        auto len = std::min(nt, n);
+        auto start = n - len;
+        auto adjusted = work;
+        for (size_t i = 0; i < len; i++) {
+            adjusted[i] = y[start + i] - seasonal[start + i];
+        }
+        float level = 0.0;
+        float end_slope = 0.0;
+        auto ok = est(adjusted, len, nt, itdeg, (float) len, &level, 1, len, work + work_stride(len, 0), true, weights + start, &end_slope);
+        model->level = ok ? level : trend[n - 1];
+        model->slope = ok ? end_slope : 0.0;
     }
 
+    return iterations;
+}
+
+// room for the work arrays plus any components the caller skips
+size_t StlParams::work_size(size_t n, size_t np) const {
+    return stl::work_size(n, std::max(np, (size_t) 2)) + 4 * work_stride(n, 0);
+}
+
+void StlParams::fit(const float* y, size_t n, size_t np, const StlOutput& output) {
+    Workspace<> workspace;
+    auto work = workspace.reserve(work_size(n, np));
+    fit(y, n, np, output, work);
+}
+
+void StlParams::fit(const float* y, size_t n, size_t np, const StlOutput& output, Workspace<>& workspace) {
+    auto work = workspace.reserve(work_size(n, np));
+    fit(y, n, np, output, work);
+}
+
+std::future<void> StlParams::fit_async(const float* y, size_t n, size_t np, const StlOutput& output, Executor& executor) {
+    auto promise = std::make_shared<std::promise<void>>();
+    auto future = promise->get_future();
+    executor.submit([params = *this, y, n, np, output, promise]() mutable {
+        try {
+            params.fit(y, n, np, output);
+            promise->set_value();
+        } catch (...) {
+            promise->set_exception(std::current_exception());
+        }
+    });
+    return future;
+}
+
+#ifdef STL_COROUTINES
+class FitAwaitable {
+    StlParams params_;
+    const float* y_;
+    size_t n_;
+    size_t np_;
+    StlOutput output_;
+    Executor* executor_;
+    std::exception_ptr error_;
+
+public:
+    FitAwaitable(const StlParams& params, const float* y, size_t n, size_t np, const StlOutput& output, Executor& executor) : params_(params), y_(y), n_(n), np_(np), output_(output), executor_(&executor) {}
+
+    inline bool await_ready() const noexcept {
+        return false;
+    }
+
+    // the awaitable lives in the suspended coroutine's frame until it is resumed
+    inline void await_suspend(std::coroutine_handle<> handle) {
+        executor_->submit([this, handle]() {
+            try {
+                params_.fit(y_, n_, np_, output_);
+            } catch (...) {
+                error_ = std::current_exception();
+            }
+            handle.resume();
+        });
+    }
+
+    inline void await_resume() {
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
+    }
+};
+
+FitAwaitable StlParams::fit_awaitable(const float* y, size_t n, size_t np, const StlOutput& output, Executor& executor) {
+    return FitAwaitable(*this, y, n, np, output, executor);
+}
+#endif
+
+void StlParams::fit(const float* y, size_t n, size_t np, const StlOutput& output, float* work, bool warm) {
+    if (n < 2 * np) {
+        throw std::invalid_argument("series has less than two periods");
+    }
+
+    auto stride = work_stride(n, 0);
+    auto seasonal = output.seasonal != nullptr ? output.seasonal : work;
+    auto trend = output.trend != nullptr ? output.trend : work + stride;
+    auto weights = output.weights != nullptr ? output.weights : work + 2 * stride;
+    auto slope = output.trend_slope != nullptr ? output.trend_slope : work + 3 * stride;
+    auto slopes = output.trend_slope != nullptr;
+    if (slopes) {
+        std::fill(slope, slope + n, 0.0);
+    }
+    if (!warm || output.trend == nullptr) {
+        std::fill(trend, trend + n, 0.0);
+    }
+
+    auto iterations = decompose(y, n, np, seasonal, trend, weights, work + 4 * stride, slopes ? slope : nullptr, output.model);
+    if (output.iterations != nullptr) {
+        *output.iterations = iterations;
+    }
+
+    if (output.model != nullptr) {
+        // decompose fits with a period of at least 2
+        auto period = std::min(std::max(np, (size_t) 2), n);
+        output.model->seasonal.assign(seasonal + n - period, seasonal + n);
+    }
+
+    // the work arrays are free once the components are done
+    auto scratch = work + 4 * stride;
+    auto score = output.anomaly_scores != nullptr || output.anomalies != nullptr;
+
+    if (output.remainder != nullptr || output.seasonally_adjusted != nullptr || output.strength != nullptr || score) {
+        // the strength is computed in the same pass as the remainder
+        auto acc = StrengthAccumulator(seasonal[0], trend[0], y[0] - seasonal[0] - trend[0]);
+        for (size_t i = 0; i < n; i++) {
+            auto adjusted = y[i] - seasonal[i];
+            float remainder = adjusted - trend[i];
+            if (output.remainder != nullptr) {
+                output.remainder[i] = remainder;
+            }
+            if (output.seasonally_adjusted != nullptr) {
+                output.seasonally_adjusted[i] = adjusted;
+            }
+            if (output.strength != nullptr) {
+                acc.add(seasonal[i], trend[i], remainder);
+            }
+            if (score) {
+                scratch[i] = remainder;
+            }
+        }
+        if (output.strength != nullptr) {
+            *output.strength = acc.value(n);
+        }
+    }
+
+    if (score) {
+        auto median = [&]() {
+            auto mid1 = (n - 1) / 2;
+            auto mid2 = n / 2;
+            std::nth_element(scratch, scratch + mid2, scratch + n);
+            auto v = (double) scratch[mid2];
+            if (mid1 != mid2) {
+                v = (v + *std::max_element(scratch, scratch + mid2)) / 2.0;
+            }
+            return v;
+        };
+
+        auto center = median();
+        auto mean_dev = 0.0;
+        for (size_t i = 0; i < n; i++) {
+            float remainder = (y[i] - seasonal[i]) - trend[i];
+            scratch[i] = fabs(remainder - center);
+            mean_dev += scratch[i];
+        }
+        // 1.4826 * MAD estimates the standard deviation for normal data
+        // the mean absolute deviation is used when more than half the values are at the median
+        auto scale = 1.4826 * median();
+        if (scale <= 0.0) {
+            scale = 1.2533 * mean_dev / n;
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            float remainder = (y[i] - seasonal[i]) - trend[i];
+            float z = scale > 0.0 ? (remainder - center) / scale : 0.0;
+            if (output.anomaly_scores != nullptr) {
+                output.anomaly_scores[i] = z;
+            }
+            if (output.anomalies != nullptr) {
+                output.anomalies[i] = fabs(z) > this->anomaly_threshold_;
+            }
+        }
+    }
+}
+
+template <typename Allocator>
+BasicStlResult<Allocator> StlParams::fit(const float* y, size_t n, size_t np, const Allocator& alloc) {
+    Workspace<Allocator> workspace(alloc);
+    auto work = workspace.reserve(work_size(n, np));
+    return fit(y, n, np, alloc, work);
+}
+
+template <typename Allocator>
+BasicStlResult<Allocator> StlParams::fit(const float* y, size_t n, size_t np, const Allocator& alloc, float* work) {
+    if (n < 2 * np) {
+        throw std::invalid_argument("series has less than two periods");
+    }
+
+    auto res = BasicStlResult<Allocator> {
+        std::vector<float, Allocator>(n, alloc),
+        std::vector<float, Allocator>(n, alloc),
+        std::vector<float, Allocator>(n, alloc),
+        std::vector<float, Allocator>(n, alloc)
+    };
+
+    StlOutput output;
+    output.seasonal = res.seasonal.data();
+    output.trend = res.trend.data();
+    output.remainder = res.remainder.data();
+    output.weights = res.weights.data();
+    fit(y, n, np, output, work);
+
     return res;
 }
 
+std::vector<PeriodCandidate> StlParams::scan(const float* y, size_t n, const std::vector<size_t>& periods, StlResult* best) {
+    size_t max_np = 2;
+    for (auto np : periods) {
+        if (n < 2 * np) {
+            throw std::invalid_argument("series has less than two periods");
+        }
+        max_np = std::max(max_np, np);
+    }
+
+    // every candidate shares the workspace and the component buffers
+    Workspace<> workspace;
+    auto work = workspace.reserve(work_size(n, max_np));
+    StlResult current;
+    if (best != nullptr) {
+        for (auto v : {&current.seasonal, &current.trend, &current.remainder, &current.weights, &best->seasonal, &best->trend, &best->remainder, &best->weights}) {
+            v->resize(n);
+        }
+    }
+
+    std::vector<PeriodCandidate> scores;
+    scores.reserve(periods.size());
+    float best_score = 0.0;
+    for (auto np : periods) {
+        StlStrength strength;
+        StlOutput output;
+        output.strength = &strength;
+        if (best != nullptr) {
+            output.seasonal = current.seasonal.data();
+            output.trend = current.trend.data();
+            output.remainder = current.remainder.data();
+            output.weights = current.weights.data();
+        }
+        fit(y, n, np, output, work);
+
+        if (best != nullptr && (scores.empty() || strength.seasonal > best_score)) {
+            std::swap(*best, current);
+            best_score = strength.seasonal;
+        }
+        scores.push_back(PeriodCandidate {np, strength.seasonal});
+    }
+    return scores;
+}
+
+std::vector<PeriodCandidate> StlParams::scan(const std::vector<float>& y, const std::vector<size_t>& periods, StlResult* best) {
+    return StlParams::scan(y.data(), y.size(), periods, best);
+}
+
+std::vector<StlStrength> StlParams::rolling(const float* y, size_t n, size_t np, size_t window, size_t step, bool warm_start, Executor& executor) {
+    if (step < 1) {
+        throw std::invalid_argument("step must be at least 1");
+    }
+    if (window > n) {
+        throw std::invalid_argument("window must not be longer than the series");
+    }
+    if (window < 2 * np) {
+        throw std::invalid_argument("window has less than two periods");
+    }
+
+    auto count = (n - window) / step + 1;
+
+    // windows are split into fixed chunks and each chunk starts cold,
+    // so chunks can run in parallel
+    size_t chunk = 16;
+    auto chunks = (count + chunk - 1) / chunk;
+    auto workers = std::min(concurrency(executor), chunks);
+
+    // a warm window starts near the answer, so it skips one inner loop
+    auto warm_params = *this;
+    warm_params.ni_ = std::max(this->ni_.value_or(this->robust_ ? 1 : 2), (size_t) 2) - 1;
+
+    std::vector<StlStrength> strengths(count);
+    std::vector<Workspace<>> workspaces(workers);
+    std::vector<std::vector<float>> trends(workers);
+    parallel_for(chunks, workers, executor, [&](size_t slot, size_t c) {
+        auto work = workspaces[slot].reserve(work_size(window, np));
+        auto& trend = trends[slot];
+        trend.resize(window);
+
+        auto end = std::min(count, (c + 1) * chunk);
+        for (auto i = c * chunk; i < end; i++) {
+            auto warm = warm_start && step < window && i > c * chunk;
+            if (warm) {
+                // shift the previous trend and hold the last value
+                std::copy(trend.begin() + step, trend.end(), trend.begin());
+                std::fill(trend.end() - step, trend.end(), trend[window - step - 1]);
+            }
+
+            StlOutput output;
+            output.trend = trend.data();
+            output.strength = &strengths[i];
+            (warm ? warm_params : *this).fit(y + i * step, window, np, output, work, warm);
+        }
+    });
+    return strengths;
+}
+
+std::vector<StlStrength> StlParams::rolling(const std::vector<float>& y, size_t np, size_t window, size_t step, bool warm_start, Executor& executor) {
+    return StlParams::rolling(y.data(), y.size(), np, window, step, warm_start, executor);
+}
+
+std::vector<StlResult> StlParams::batch(const std::vector<std::vector<float>>& series, size_t np, Executor& executor) {
+    for (auto& y : series) {
+        if (y.size() < 2 * np) {
+            throw std::invalid_argument("series has less than two periods");
+        }
+    }
+
+    // group consecutive series until each task has a share of the values
+    size_t total = 0;
+    for (auto& y : series) {
+        total += y.size();
+    }
+    auto workers = concurrency(executor);
+    auto target = std::max(total / (4 * workers), parallel_task_size);
+    std::vector<size_t> starts;
+    size_t size = target;
+    for (size_t i = 0; i < series.size(); i++) {
+        if (size >= target) {
+            starts.push_back(i);
+            size = 0;
+        }
+        size += series[i].size();
+    }
+    starts.push_back(series.size());
+
+    auto params = *this;
+    params.executor_ = &executor;
+
+    std::vector<StlResult> results(series.size());
+    std::vector<Workspace<>> workspaces(workers);
+    parallel_for(starts.size() - 1, workers, executor, [&](size_t slot, size_t t) {
+        for (auto i = starts[t]; i < starts[t + 1]; i++) {
+            auto n = series[i].size();
+            auto work = workspaces[slot].reserve(params.work_size(n, np));
+            results[i] = params.fit(series[i].data(), n, np, std::allocator<float>(), work);
+        }
+    });
+    return results;
+}
+
+// a decomposition with the length, period, and window lengths fixed at compile time
+// storage is inline, so there is no heap allocation and nothing is thrown
+// 0 for a window length means the same default as StlParams, and results match StlParams::fit
+template <size_t N, size_t Np, size_t Ns = 0, size_t Nt = 0, size_t Nl = 0, int Isdeg = 0, int Itdeg = 1, bool Robust = false>
+class FixedStl {
+    static constexpr size_t ceil(double x) {
+        return (double) (size_t) x < x ? (size_t) x + 1 : (size_t) x;
+    }
+
+    static constexpr size_t odd(size_t x) {
+        return x % 2 == 0 ? x + 1 : x;
+    }
+
+    static constexpr size_t np = Np < 2 ? 2 : Np;
+    static constexpr size_t ns = odd(std::max(Ns == 0 ? Np : Ns, (size_t) 3));
+    static constexpr size_t nt = odd(std::max(Nt == 0 ? ceil((1.5 * np) / (1.0 - 1.5 / (float) ns)) : Nt, (size_t) 3));
+    static constexpr size_t nl = Nl == 0 ? odd(np) : Nl;
+    static constexpr size_t ni = Robust ? 1 : 2;
+    static constexpr size_t no = Robust ? 15 : 0;
+
+    static_assert(N >= 2 * Np, "series has less than two periods");
+    static_assert(nl >= 3, "low_pass_length must be at least 3");
+    static_assert(nl % 2 == 1, "low_pass_length must be odd");
+    static_assert(Isdeg >= 0 && Isdeg <= 2, "seasonal_degree must be 0, 1, or 2");
+    static_assert(Itdeg >= 0 && Itdeg <= 2, "trend_degree must be 0, 1, or 2");
+
+    alignas(64) std::array<float, stl::work_size(N, np)> work_;
+
+public:
+    std::array<float, N> seasonal;
+    std::array<float, N> trend;
+    std::array<float, N> remainder;
+    std::array<float, N> weights;
+
+    void fit(const float* y) noexcept {
+        trend.fill(0.0);
+        stl(y, N, np, ns, nt, nl, Isdeg, Itdeg, Itdeg, ceil(ns / 10.0), ceil(nt / 10.0), ceil(nl / 10.0), ni, no, weights.data(), seasonal.data(), trend.data(), work_.data());
+        for (size_t i = 0; i < N; i++) {
+            remainder[i] = y[i] - seasonal[i] - trend[i];
+        }
+    }
+
+    void fit(const std::array<float, N>& y) noexcept {
+        fit(y.data());
+    }
+};
+
+struct GridScore {
+    float seasonal_strength;
+    float trend_strength;
+    float remainder_variance;
+    float mean_weight;
+    float min_weight;
+};
+
+// scores each set of parameters on the same series in parallel
+// each slot reuses its workspace across the fits it runs
+std::vector<GridScore> grid_search(const float* y, size_t n, size_t np, const std::vector<StlParams>& grid, Executor& executor = default_executor()) {
+    if (n < 2 * np) {
+        throw std::invalid_argument("series has less than two periods");
+    }
+
+    std::vector<GridScore> scores(grid.size());
+    auto workers = concurrency(executor);
+    std::vector<Workspace<>> workspaces(workers);
+    std::vector<std::vector<float>> weights(workers);
+    parallel_for(grid.size(), workers, executor, [&](size_t slot, size_t i) {
+        auto& w = weights[slot];
+        w.resize(n);
+
+        StlStrength strength;
+        StlOutput output;
+        output.weights = w.data();
+        output.strength = &strength;
+        auto params = grid[i];
+        params.fit(y, n, np, output, workspaces[slot]);
+
+        auto sum = 0.0;
+        auto min = w[0];
+        for (auto v : w) {
+            sum += v;
+            min = std::min(min, v);
+        }
+        scores[i] = GridScore {strength.seasonal, strength.trend, strength.remainder_variance, (float) (sum / n), min};
+    });
+    return scores;
+}
+
+std::vector<GridScore> grid_search(const std::vector<float>& y, size_t np, const std::vector<StlParams>& grid, Executor& executor = default_executor()) {
+    return grid_search(y.data(), y.size(), np, grid, executor);
+}
+
+template <typename Range>
+StlResult StlParams::fit(const Range& y, size_t np) {
+    auto n = (size_t) y.size();
+    auto stride = work_stride(n, 0);
+
+    // the series is converted once and read from the workspace by every pass
+    Workspace<> workspace;
+    auto series = workspace.reserve(stride + work_size(n, np));
+    for (size_t i = 0; i < n; i++) {
+        series[i] = (float) y[i];
+    }
+    return fit(series, n, np, std::allocator<float>(), series + stride);
+}
+
 StlResult StlParams::fit(const std::vector<float>& y, size_t np) {
     return StlParams::fit(y.data(), y.size(), np);
 }
 
+// finds periods from peaks in the autocorrelation, which is computed with an FFT
+// reuse a detector to avoid allocating when checking many series
+class PeriodDetector {
+    std::vector<std::complex<double>> data_;
+    std::vector<std::complex<double>> twiddles_;
+    std::vector<double> power_;
+
+    // in-place radix-2 transform of length m, with m a power of two
+    // twiddles_[k * size / m] is exp(-2 pi i k / m), where size is twice the transform length
+    inline void fft(size_t m, bool inverse) {
+        auto x = data_.data();
+        for (size_t i = 1, j = 0; i < m; i++) {
+            auto bit = m >> 1;
+            for (; j & bit; bit >>= 1) {
+                j ^= bit;
+            }
+            j ^= bit;
+            if (i < j) {
+                std::swap(x[i], x[j]);
+            }
+        }
+        for (size_t len = 2; len <= m; len <<= 1) {
+            auto step = 2 * m / len;
+            for (size_t i = 0; i < m; i += len) {
+                for (size_t k = 0; k < len / 2; k++) {
+                    auto w = inverse ? std::conj(twiddles_[k * step]) : twiddles_[k * step];
+                    auto u = x[i + k];
+                    auto v = x[i + k + len / 2] * w;
+                    x[i + k] = u + v;
+                    x[i + k + len / 2] = u - v;
+                }
+            }
+        }
+    }
+
+public:
+    // ranked by score (the autocorrelation at that lag), with periods from 2 to n / 2
+    inline std::vector<PeriodCandidate> detect(const float* y, size_t n, size_t max_candidates = 5) {
+        if (n < 4) {
+            throw std::invalid_argument("series must have at least four values");
+        }
+
+        // padding to at least n + max_lag keeps the autocorrelation from wrapping around
+        auto max_lag = n / 2;
+        size_t size = 4;
+        while (size < n + max_lag + 2) {
+            size <<= 1;
+        }
+        auto half = size / 2;
+
+        if (twiddles_.size() != half + 1) {
+            auto pi = std::acos(-1.0);
+            twiddles_.resize(half + 1);
+            for (size_t k = 0; k <= half; k++) {
+                twiddles_[k] = std::polar(1.0, -2.0 * pi * (double) k / (double) size);
+            }
+        }
+        data_.assign(half, 0.0);
+        power_.resize(half + 1);
+
+        // remove the least squares line so a trend does not dominate
+        auto xm = (n - 1) / 2.0;
+        auto ym = 0.0;
+        for (size_t i = 0; i < n; i++) {
+            ym += y[i];
+        }
+        ym /= n;
+        auto sxy = 0.0;
+        auto sxx = 0.0;
+        for (size_t i = 0; i < n; i++) {
+            sxy += (i - xm) * (y[i] - ym);
+            sxx += (i - xm) * (i - xm);
+        }
+        auto slope = sxy / sxx;
+
+        // the real series is packed into a complex one of half the length
+        for (size_t i = 0; i < n; i++) {
+            auto v = y[i] - ym - slope * (i - xm);
+            if (i % 2 == 0) {
+                data_[i / 2].real(v);
+            } else {
+                data_[i / 2].imag(v);
+            }
+        }
+        fft(half, false);
+
+        // power spectrum, which is real and symmetric
+        for (size_t k = 0; k <= half; k++) {
+            auto z = data_[k % half];
+            auto zc = std::conj(data_[(half - k) % half]);
+            auto e = (z + zc) * 0.5;
+            auto o = (z - zc) * std::complex<double>(0.0, -0.5);
+            power_[k] = std::norm(e + twiddles_[k] * o);
+        }
+
+        // inverse transform of the power spectrum is the autocovariance
+        for (size_t k = 0; k < half; k++) {
+            auto e = (power_[k] + power_[half - k]) * 0.5;
+            auto o = (power_[k] - power_[half - k]) * 0.5 * std::conj(twiddles_[k]);
+            data_[k] = e + std::complex<double>(0.0, 1.0) * o;
+        }
+        fft(half, true);
+
+        auto acf = [&](size_t t) {
+            return t % 2 == 0 ? data_[t / 2].real() : data_[t / 2].imag();
+        };
+
+        std::vector<PeriodCandidate> candidates;
+        auto c0 = acf(0);
+        if (c0 <= 0.0) {
+            return candidates;
+        }
+        for (size_t t = 2; t <= max_lag; t++) {
+            auto c = acf(t);
+            if (c > 0.0 && c > acf(t - 1) && c >= acf(t + 1)) {
+                candidates.push_back(PeriodCandidate {t, (float) (c / c0)});
+            }
+        }
+
+        std::sort(candidates.begin(), candidates.end(), [](const PeriodCandidate& a, const PeriodCandidate& b) {
+            return a.score > b.score || (a.score == b.score && a.period < b.period);
+        });
+
+        // multiples of a period score about as high as the period itself, so they are dropped
+        auto dominates = [](const PeriodCandidate& p, const PeriodCandidate& q) {
+            auto k = (q.period + p.period / 2) / p.period;
+            return p.period < q.period && k > 1 && q.period + k >= k * p.period && q.period <= k * p.period + k && p.score >= 0.95 * q.score;
+        };
+
+        std::vector<PeriodCandidate> ranked;
+        for (auto& c : candidates) {
+            // lower peaks can no longer change the top candidates
+            if (ranked.size() >= max_candidates && c.score < 0.95 * ranked[max_candidates - 1].score) {
+                break;
+            }
+            if (std::any_of(ranked.begin(), ranked.end(), [&](const PeriodCandidate& r) { return dominates(r, c); })) {
+                continue;
+            }
+            ranked.erase(std::remove_if(ranked.begin(), ranked.end(), [&](const PeriodCandidate& r) { return dominates(c, r); }), ranked.end());
+            ranked.push_back(c);
+        }
+        if (ranked.size() > max_candidates) {
+            ranked.resize(max_candidates);
+        }
+        return ranked;
+    }
+
+    inline std::vector<PeriodCandidate> detect(const std::vector<float>& y, size_t max_candidates = 5) {
+        return detect(y.data(), y.size(), max_candidates);
+    }
+};
+
+std::vector<PeriodCandidate> detect_periods(const float* y, size_t n, size_t max_candidates = 5) {
+    return PeriodDetector().detect(y, n, max_candidates);
+}
+
+std::vector<PeriodCandidate> detect_periods(const std::vector<float>& y, size_t max_candidates = 5) {
+    return detect_periods(y.data(), y.size(), max_candidates);
+}
+
+// loess smoothing of evenly spaced values
+// points far enough from the ends share one set of weights, which is computed once per length
+// reuse a smoother to avoid allocating when smoothing many series
+class Loess {
+    size_t len_;
+    int ideg_;
+    size_t njump_;
+    std::vector<float> res_;
+    std::vector<float> kernel_;
+    size_t kernel_n_ = 0;
+
+    // the weights of the fit and its slope for the point at the center of a window
+    // est is linear in y, so each weight is the fit to a unit vector
+    inline void build_kernel(size_t n) {
+        if (kernel_n_ == n) {
+            return;
+        }
+        kernel_.assign(3 * len_, 0.0);
+        auto unit = kernel_.data() + 2 * len_;
+        auto xs = (float) ((len_ + 1) / 2);
+        for (size_t k = 0; k < len_; k++) {
+            unit[k] = 1.0;
+            est(unit, n, len_, ideg_, xs, &kernel_[k], 1, len_, res_.data(), false, nullptr, &kernel_[len_ + k]);
+            unit[k] = 0.0;
+        }
+        kernel_n_ = n;
+    }
+
+public:
+    explicit Loess(size_t bandwidth, int degree = 1, size_t jump = 1) : len_(bandwidth), ideg_(degree), njump_(jump) {
+        if (bandwidth < 3) {
+            throw std::invalid_argument("bandwidth must be at least 3");
+        }
+        if (degree < 0 || degree > 2) {
+            throw std::invalid_argument("degree must be 0, 1, or 2");
+        }
+        if (jump < 1) {
+            throw std::invalid_argument("jump must be at least 1");
+        }
+    }
+
+    // weights, if not null, are robustness weights for each point
+    // slopes, if not null, gets the slope of the local fit at each point
+    inline void smooth(const float* y, size_t n, float* ys, const float* weights = nullptr, float* slopes = nullptr) {
+        if (n == 0) {
+            return;
+        }
+        if (res_.size() < std::max(n, len_)) {
+            res_.resize(std::max(n, len_));
+        }
+
+        const float* kernel = nullptr;
+        if (weights == nullptr && len_ < n) {
+            build_kernel(n);
+            kernel = kernel_.data();
+        }
+        ess(y, n, len_, ideg_, njump_, weights != nullptr, weights, ys, res_.data(), slopes, kernel);
+    }
+
+    // smooths y at sorted x-values, which do not need to be evenly spaced
+    // each fit uses the bandwidth points nearest to x[i]
+    inline void smooth(const float* x, const float* y, size_t n, float* ys, const float* weights = nullptr, float* slopes = nullptr) {
+        if (n == 0) {
+            return;
+        }
+        if (res_.size() < std::max(n, len_)) {
+            res_.resize(std::max(n, len_));
+        }
+        ess(x, y, n, len_, ideg_, njump_, weights != nullptr, weights, ys, res_.data(), slopes);
+    }
+
+    inline std::vector<float> smooth(const std::vector<float>& y) {
+        std::vector<float> ys(y.size());
+        smooth(y.data(), y.size(), ys.data());
+        return ys;
+    }
+
+    inline std::vector<float> smooth(const std::vector<float>& y, const std::vector<float>& weights) {
+        if (weights.size() != y.size()) {
+            throw std::invalid_argument("weights must be the same size as the series");
+        }
+        std::vector<float> ys(y.size());
+        smooth(y.data(), y.size(), ys.data(), weights.data());
+        return ys;
+    }
+};
+
 }
@@ -1,6 +1,8 @@
 #include <cassert>
 #include <cstring>
+#include <future>
 #include <iostream>
+#include <memory>
 #include <vector>
 
 #include "../include/stl.hpp"
@@ -37,6 +39,36 @@ void assert_elements_in_delta(const std::vector<float>& exp, const std::vector<f
     }
 }
 
+template <typename T>
+class CountingAllocator {
+public:
+    using value_type = T;
+
+    size_t* count;
+
+    explicit CountingAllocator(size_t* count) : count(count) {}
+
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U>& other) : count(other.count) {}
+
+    T* allocate(size_t n) {
+        *count += 1;
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, size_t n) {
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    bool operator==(const CountingAllocator& other) const {
+        return count == other.count;
+    }
+
+    bool operator!=(const CountingAllocator& other) const {
+        return count != other.count;
+    }
+};
+
 std::vector<float> generate_series() {
     std::vector<float> series = {
         5.0, 9.0, 2.0, 9.0, 0.0, 6.0, 3.0, 8.0, 5.0, 8.0,
@@ -46,6 +78,34 @@ std::vector<float> generate_series() {
     return series;
 }
 
+// long enough to split the subseries across an executor
+std::vector<float> generate_long_series(size_t n = 100000) {
+    std::vector<float> series(n);
+    for (size_t i = 0; i < n; i++) {
+        series[i] = 10.0 + 0.001 * i + ((i % 24) < 8 ? 3.0 : -1.5) + 0.1 * ((i * 7919) % 13);
+    }
+    return series;
+}
+
+// a daily pattern on hourly values with a trend and some noise
+std::vector<float> generate_hourly_series(size_t n) {
+    std::vector<float> series(n);
+    for (size_t i = 0; i < n; i++) {
+        series[i] = 10.0 + 0.05 * i + ((i % 24) < 12 ? 3.0 : -3.0) + 0.05 * ((i * 7919) % 13) - 0.3;
+    }
+    return series;
+}
+
+// a weekly pattern on top of a polynomial trend
+std::vector<float> generate_trend_series(size_t n, double level, double slope, double curvature = 0.0) {
+    std::vector<float> pattern = {1.0, -2.0, 3.0, 0.0, -1.0, 2.0, -3.0};
+    std::vector<float> series(n);
+    for (size_t i = 0; i < n; i++) {
+        series[i] = level + slope * i + curvature * i * i + pattern[i % 7];
+    }
+    return series;
+}
+
 void test_works() {
     auto series = generate_series();
     auto result = stl::params().fit(series, 7);
@@ -64,6 +124,53 @@ void test_robust() {
     assert_elements_in_delta({0.99374926, 0.8129377, 0.9385952, 0.9458036, 0.29742217}, first(result.weights, 5));
 }
 
+void test_allocator() {
+    auto series = generate_series();
+    size_t count = 0;
+    auto result = stl::params().fit(series.data(), series.size(), 7, CountingAllocator<float>(&count));
+    assert(count == 5);
+    assert_elements_in_delta({0.36926576, 0.75655484, -1.3324139, 1.9553658, -0.6044802}, first(std::vector<float>(result.seasonal.begin(), result.seasonal.end()), 5));
+    assert_in_delta(0.284111676315015, result.seasonal_strength());
+}
+
+void test_strided() {
+    auto series = generate_series();
+    std::vector<double> matrix;
+    for (auto v : series) {
+        matrix.push_back(0.0);
+        matrix.push_back(v);
+    }
+    auto expected = stl::params().fit(series, 7);
+    auto result = stl::params().fit(stl::StridedView<double>(matrix.data() + 1, series.size(), 2), 7);
+    assert_elements_in_delta(expected.seasonal, result.seasonal);
+    assert_elements_in_delta(expected.trend, result.trend);
+    assert_elements_in_delta(expected.remainder, result.remainder);
+}
+
+void test_integer_series() {
+    std::vector<int> series;
+    for (auto v : generate_series()) {
+        series.push_back((int) v);
+    }
+    auto result = stl::params().fit(series, 7);
+    assert_elements_in_delta({0.36926576, 0.75655484, -1.3324139, 1.9553658, -0.6044802}, first(result.seasonal, 5));
+}
+
+void test_output() {
+    auto series = generate_series();
+    auto expected = stl::params().fit(series, 7);
+    std::vector<float> trend(series.size(), -1.0);
+    std::vector<float> adjusted(series.size());
+    stl::StlOutput output;
+    output.trend = trend.data();
+    output.seasonally_adjusted = adjusted.data();
+    stl::params().fit(series.data(), series.size(), 7, output);
+    assert_elements_in_delta(expected.trend, trend);
+    for (size_t i = 0; i < series.size(); i++) {
+        assert_in_delta(series[i] - expected.seasonal[i], adjusted[i]);
+    }
+}
+
 void test_too_few_periods() {
     ASSERT_EXCEPTION(
         stl::params().fit(generate_series(), 16),
@@ -74,9 +181,9 @@ void test_too_few_periods() {
 
 void test_bad_seasonal_degree() {
     ASSERT_EXCEPTION(
-        stl::params().seasonal_degree(2).fit(generate_series(), 7),
+        stl::params().seasonal_degree(3).fit(generate_series(), 7),
         std::invalid_argument,
-        "seasonal_degree must be 0 or 1"
+        "seasonal_degree must be 0, 1, or 2"
     );
 }
 
@@ -90,12 +197,614 @@ void test_trend_strength() {
     assert_in_delta(0.16384245231864702, result.trend_strength());
 }
 
+void test_strengths() {
+    auto series = generate_series();
+    auto result = stl::params().fit(series, 7);
+    auto strengths = result.strengths();
+    assert_in_delta(0.284111676315015, strengths.seasonal);
+    assert_in_delta(0.16384245231864702, strengths.trend);
+    assert_in_delta(stl::var(result.remainder), strengths.remainder_variance);
+
+    stl::StlStrength strength;
+    stl::StlOutput output;
+    output.strength = &strength;
+    stl::params().fit(series.data(), series.size(), 7, output);
+    assert_in_delta(strengths.seasonal, strength.seasonal);
+    assert_in_delta(strengths.trend, strength.trend);
+}
+
+void test_estimate_strengths() {
+    auto strengths = stl::estimate_strengths(generate_series(), 7);
+    assert_in_delta(0.30499125, strengths.seasonal);
+    assert_in_delta(0.22798814, strengths.trend);
+    assert_in_delta(4.4067583, strengths.remainder_variance);
+
+    auto series = generate_hourly_series(240);
+    auto expected = stl::params().seasonal_length(2401).fit(series, 24).strengths();
+    strengths = stl::estimate_strengths(series, 24);
+    assert(fabs(expected.seasonal - strengths.seasonal) < 0.01);
+    assert(fabs(expected.trend - strengths.trend) < 0.01);
+}
+
+void test_estimate_strengths_too_few_periods() {
+    ASSERT_EXCEPTION(
+        stl::estimate_strengths(generate_series(), 16),
+        std::invalid_argument,
+        "series has less than two periods"
+    );
+}
+
+void test_detect_periods() {
+    auto series = generate_hourly_series(240);
+    auto candidates = stl::detect_periods(series);
+    assert(candidates.size() == 1);
+    assert(candidates[0].period == 24);
+    assert_in_delta(0.89341778, candidates[0].score);
+
+    auto result = stl::params().fit(series, candidates[0].period);
+    assert(result.seasonal_strength() > 0.9);
+}
+
+void test_detect_periods_too_short() {
+    ASSERT_EXCEPTION(
+        stl::detect_periods({1.0, 2.0, 3.0}),
+        std::invalid_argument,
+        "series must have at least four values"
+    );
+}
+
+void test_scan() {
+    auto series = generate_hourly_series(240);
+    stl::StlResult best;
+    auto scores = stl::params().scan(series, {7, 24, 12}, &best);
+    assert(scores.size() == 3);
+    assert(scores[1].period == 24);
+    assert(scores[1].score > scores[0].score);
+    assert(scores[1].score > scores[2].score);
+    assert_in_delta(stl::params().fit(series, 24).seasonal_strength(), scores[1].score);
+    assert_elements_in_delta(stl::params().fit(series, 24).seasonal, best.seasonal);
+}
+
+void test_scan_too_few_periods() {
+    ASSERT_EXCEPTION(
+        stl::params().scan(generate_series(), {7, 16}),
+        std::invalid_argument,
+        "series has less than two periods"
+    );
+}
+
+void test_grid_search() {
+    auto series = generate_series();
+    std::vector<stl::StlParams> grid;
+    for (size_t ns : {7, 11}) {
+        for (auto robust : {false, true}) {
+            grid.push_back(stl::params().seasonal_length(ns).robust(robust));
+        }
+    }
+    for (size_t threads : {1, 4}) {
+        stl::ThreadPool pool(threads);
+        auto scores = stl::grid_search(series, 7, grid, pool);
+        assert(scores.size() == grid.size());
+        for (size_t i = 0; i < grid.size(); i++) {
+            auto result = grid[i].fit(series, 7);
+            auto strengths = result.strengths();
+            assert_in_delta(strengths.seasonal, scores[i].seasonal_strength);
+            assert_in_delta(strengths.trend, scores[i].trend_strength);
+            assert_in_delta(strengths.remainder_variance, scores[i].remainder_variance);
+            assert_in_delta(*std::min_element(result.weights.begin(), result.weights.end()), scores[i].min_weight);
+        }
+    }
+    assert_in_delta(0.284111676315015, stl::grid_search(series, 7, grid)[0].seasonal_strength);
+}
+
+void test_rolling() {
+    std::vector<float> series;
+    for (size_t i = 0; i < 200; i++) {
+        series.push_back(10.0 + 0.05 * i + ((i % 7) < 3 ? 3.0 : -2.0) + 0.1 * ((i * 7919) % 13));
+    }
+    auto cold = stl::params().rolling(series, 7, 42, 5, false);
+    assert(cold.size() == 32);
+    for (size_t i = 0; i < cold.size(); i++) {
+        auto expected = stl::params().fit(series.data() + i * 5, 42, 7).strengths();
+        assert_in_delta(expected.seasonal, cold[i].seasonal);
+        assert_in_delta(expected.trend, cold[i].trend);
+    }
+
+    stl::ThreadPool single(1);
+    stl::ThreadPool pool(4);
+    auto warm = stl::params().rolling(series, 7, 42, 5, true, single);
+    auto parallel = stl::params().rolling(series, 7, 42, 5, true, pool);
+    for (size_t i = 0; i < warm.size(); i++) {
+        assert(fabs(cold[i].seasonal - warm[i].seasonal) < 0.05);
+        assert(warm[i].seasonal == parallel[i].seasonal);
+    }
+
+    // warm windows skip an inner loop, and each chunk of 16 windows starts cold
+    std::atomic<size_t> loops{0};
+    auto counted = stl::params().progress([&](size_t, size_t) { loops++; });
+    counted.rolling(series, 7, 42, 5, false);
+    assert(loops == 64);
+    loops = 0;
+    counted.rolling(series, 7, 42, 5, true);
+    assert(loops == 34);
+}
+
+void test_rolling_short_window() {
+    ASSERT_EXCEPTION(
+        stl::params().rolling(generate_series(), 7, 10, 1),
+        std::invalid_argument,
+        "window has less than two periods"
+    );
+}
+
+void test_anomalies() {
+    auto series = generate_series();
+    series[15] = 30.0;
+    std::vector<float> scores(series.size());
+    std::unique_ptr<bool[]> flags(new bool[series.size()]);
+    stl::StlOutput output;
+    output.anomaly_scores = scores.data();
+    output.anomalies = flags.get();
+    stl::params().robust(true).fit(series.data(), series.size(), 7, output);
+    assert_elements_in_delta({-0.2125822, 1.294345, -0.6991534, 0.6245707, -2.564256}, first(scores, 5));
+    assert_in_delta(10.60751, scores[15]);
+    for (size_t i = 0; i < series.size(); i++) {
+        assert(flags[i] == (i == 15));
+    }
+
+    stl::params().robust(true).anomaly_threshold(2.5).fit(series.data(), series.size(), 7, output);
+    assert(flags[4] && flags[15]);
+}
+
+void test_forecast() {
+    auto series = generate_trend_series(84, 10.0, 0.5);
+    stl::StlModel model;
+    stl::StlOutput output;
+    output.model = &model;
+    stl::params().fit(series.data(), 70, 7, output);
+    assert(model.seasonal.size() == 7);
+    assert(fabs(model.slope - 0.5) < 0.01);
+
+    auto forecast = model.forecast(14);
+    assert(forecast.size() == 14);
+    for (size_t i = 0; i < 14; i++) {
+        assert(fabs(forecast[i] - series[70 + i]) < 0.15);
+    }
+}
+
+void test_forecast_short_period() {
+    std::vector<float> series;
+    for (size_t i = 0; i < 44; i++) {
+        series.push_back(10.0 + 0.1 * i + (i % 2 == 0 ? 2.0 : -2.0));
+    }
+    for (size_t np : {0, 1}) {
+        stl::StlModel model;
+        stl::StlOutput output;
+        output.model = &model;
+        stl::params().fit(series.data(), 40, np, output);
+        assert(model.seasonal.size() == 2);
+
+        auto forecast = model.forecast(4);
+        for (size_t i = 0; i < 4; i++) {
+            assert(fabs(forecast[i] - series[40 + i]) < 0.15);
+        }
+    }
+
+    stl::StlModel model;
+    model.level = 1.0;
+    model.slope = 0.5;
+    assert(model.forecast(2) == std::vector<float>({1.5, 2.0}));
+}
+
+void test_forecast_offset() {
+    auto series = generate_trend_series(94, 1000000.0, 0.5);
+    stl::StlModel model;
+    stl::StlOutput output;
+    output.model = &model;
+    stl::params().fit(series.data(), 70, 7, output);
+    assert(fabs(model.slope - 0.5) < 0.01);
+    auto forecast = model.forecast(24);
+    for (size_t i = 0; i < 24; i++) {
+        assert(fabs(forecast[i] - series[70 + i]) < 0.5);
+    }
+}
+
+void test_forecast_long() {
+    auto series = generate_trend_series(20024, 1000.0, 0.001);
+    stl::StlModel model;
+    stl::StlOutput output;
+    output.model = &model;
+    stl::params().fit(series.data(), 20000, 7, output);
+    assert(fabs(model.slope - 0.001) < 0.0001);
+    auto forecast = model.forecast(24);
+    for (size_t i = 0; i < 24; i++) {
+        assert(fabs(forecast[i] - series[20000 + i]) < 0.01);
+    }
+}
+
+void test_trend_slope() {
+    auto series = generate_trend_series(70, 10.0, 0.5, 0.01);
+    std::vector<float> trend(series.size());
+    std::vector<float> slope(series.size());
+    stl::StlOutput output;
+    output.trend = trend.data();
+    output.trend_slope = slope.data();
+    stl::params().trend_jump(3).fit(series.data(), series.size(), 7, output);
+    for (size_t i = 10; i < 60; i++) {
+        assert(fabs(slope[i] - (0.5 + 0.02 * i)) < 0.05);
+        assert(fabs(slope[i] - (trend[i + 1] - trend[i - 1]) / 2.0) < 0.05);
+    }
+}
+
+void test_trend_slope_offset() {
+    std::vector<float> y(200);
+    for (size_t i = 0; i < y.size(); i++) {
+        y[i] = 1000000.0 + 0.5 * i;
+    }
+    std::vector<float> ys(y.size());
+    std::vector<float> res(y.size());
+    std::vector<float> slopes(y.size());
+    stl::ess(y.data(), y.size(), 15, 1, 1, false, nullptr, ys.data(), res.data(), slopes.data());
+    for (auto v : slopes) {
+        assert(fabs(v - 0.5) < 0.001);
+    }
+
+    // long enough that the fitted trend falls back to local means
+    auto series = generate_trend_series(20000, 1000.0, 0.001);
+    std::vector<float> slope(series.size());
+    stl::StlOutput output;
+    output.trend_slope = slope.data();
+    stl::params().fit(series.data(), series.size(), 7, output);
+    for (size_t i = 100; i < series.size() - 100; i++) {
+        assert(fabs(slope[i] - 0.001) < 0.0001);
+    }
+}
+
+void test_quadratic_trend() {
+    auto series = generate_trend_series(70, 10.0, 0.5, 0.01);
+    std::vector<float> trend(series.size());
+    std::vector<float> slope(series.size());
+    stl::StlOutput output;
+    output.trend = trend.data();
+    output.trend_slope = slope.data();
+    stl::params().seasonal_degree(2).trend_degree(2).low_pass_degree(2).fit(series.data(), series.size(), 7, output);
+    for (size_t i = 0; i < series.size(); i++) {
+        assert(fabs(trend[i] - (10.0 + 0.5 * i + 0.01 * i * i)) < 0.05);
+        assert(fabs(slope[i] - (0.5 + 0.02 * i)) < 0.01);
+    }
+}
+
+void test_irregular() {
+    auto y = generate_series();
+    std::vector<float> x(y.size());
+    for (size_t i = 0; i < x.size(); i++) {
+        x[i] = i + 1;
+    }
+    std::vector<float> ys(y.size());
+    stl::Loess loess(7);
+    loess.smooth(x.data(), y.data(), y.size(), ys.data());
+    assert_elements_in_delta(loess.smooth(y), ys);
+
+    std::vector<float> weights(y.size(), 1.0);
+    weights[3] = 0.0;
+    loess.smooth(x.data(), y.data(), y.size(), ys.data(), weights.data());
+    assert_elements_in_delta(loess.smooth(y, weights), ys);
+
+    // a quadratic is reproduced at any spacing
+    for (size_t i = 0; i < x.size(); i++) {
+        x[i] = 0.5 * i + (i % 3 == 0 ? 0.2 : 0.0);
+        y[i] = 1.0 + 2.0 * x[i] - 0.1 * x[i] * x[i];
+    }
+    std::vector<float> slopes(y.size());
+    stl::Loess(9, 2).smooth(x.data(), y.data(), y.size(), ys.data(), nullptr, slopes.data());
+    for (size_t i = 0; i < x.size(); i++) {
+        assert_in_delta(y[i], ys[i]);
+        assert_in_delta(2.0 - 0.2 * x[i], slopes[i]);
+    }
+}
+
+void test_loess() {
+    auto y = generate_series();
+    std::vector<float> expected(y.size());
+    std::vector<float> res(y.size());
+    stl::ess(y.data(), y.size(), 7, 1, 1, false, nullptr, expected.data(), res.data());
+
+    stl::Loess loess(7);
+    assert_elements_in_delta(expected, loess.smooth(y));
+    assert_elements_in_delta(expected, loess.smooth(y));
+
+    std::vector<float> weights(y.size(), 1.0);
+    weights[3] = 0.0;
+    stl::ess(y.data(), y.size(), 7, 1, 1, true, weights.data(), expected.data(), res.data());
+    assert_elements_in_delta(expected, loess.smooth(y, weights));
+
+    ASSERT_EXCEPTION(stl::Loess(7, 3), std::invalid_argument, "degree must be 0, 1, or 2");
+}
+
+void test_limits() {
+    auto series = generate_series();
+    auto expected = stl::params().robust(true).fit(series, 7);
+
+    std::vector<float> seasonal(series.size());
+    std::vector<float> weights(series.size());
+    size_t iterations = 0;
+    stl::StlOutput output;
+    output.seasonal = seasonal.data();
+    output.weights = weights.data();
+    output.iterations = &iterations;
+
+    stl::params().robust(true).iteration_limit(100).fit(series.data(), series.size(), 7, output);
+    assert(iterations == 16);
+    assert(seasonal == expected.seasonal);
+    assert(weights == expected.weights);
+
+    stl::params().robust(true).iteration_limit(1).fit(series.data(), series.size(), 7, output);
+    assert(iterations == 1);
+    assert(seasonal == stl::params().inner_loops(1).fit(series, 7).seasonal);
+    assert(weights == std::vector<float>(series.size(), 1.0));
+
+    stl::params().robust(true).time_limit(std::chrono::nanoseconds(0)).fit(series.data(), series.size(), 7, output);
+    assert(iterations == 1);
+}
+
+void test_cancel() {
+    auto series = generate_series();
+    std::vector<size_t> completed;
+    stl::params().robust(true).progress([&](size_t done, size_t total) {
+        assert(total == 16);
+        completed.push_back(done);
+    }).fit(series, 7);
+    assert(completed.size() == 16);
+    assert(completed.back() == 16);
+
+    stl::CancellationToken token;
+    ASSERT_EXCEPTION(
+        stl::params().robust(true).cancellation_token(token).progress([&](size_t done, size_t) {
+            if (done == 3) {
+                token.cancel();
+            }
+        }).fit(series, 7),
+        stl::CancelledError,
+        "fit was cancelled"
+    );
+    ASSERT_EXCEPTION(stl::params().cancellation_token(token).fit(series, 7), stl::CancelledError, "fit was cancelled");
+}
+
+void test_batch() {
+    std::vector<std::vector<float>> series;
+    for (size_t i = 0; i < 20; i++) {
+        auto y = generate_series();
+        y.resize(14 + i);
+        series.push_back(y);
+    }
+    auto large = generate_long_series();
+    series.push_back(large);
+
+    stl::ThreadPool pool(4);
+    auto results = stl::params().robust(true).batch(series, 7, pool);
+    assert(results.size() == series.size());
+    for (size_t i = 0; i < series.size(); i++) {
+        auto expected = stl::params().robust(true).fit(series[i], 7);
+        assert(results[i].seasonal == expected.seasonal);
+        assert(results[i].trend == expected.trend);
+        assert(results[i].weights == expected.weights);
+    }
+
+    ASSERT_EXCEPTION(stl::params().batch({generate_series(), {1.0, 2.0}}, 7, pool), std::invalid_argument, "series has less than two periods");
+}
+
+// runs each task on the calling thread and reports no concurrency
+class InlineExecutor : public stl::Executor {
+public:
+    void submit(std::function<void()> task) override {
+        task();
+    }
+
+    size_t concurrency() const override {
+        return 0;
+    }
+};
+
+void test_zero_concurrency() {
+    auto large = generate_long_series();
+    InlineExecutor executor;
+    auto expected = stl::params().fit(large, 7);
+    assert(stl::params().executor(executor).fit(large, 7).seasonal == expected.seasonal);
+
+    auto results = stl::params().batch({generate_series(), large}, 7, executor);
+    assert(results[1].trend == expected.trend);
+    assert(stl::params().rolling(large.data(), large.size(), 7, 2000, 20000, true, executor).size() == 5);
+}
+
+// reports one thread the first time and the full pool after that
+class GrowingExecutor : public stl::Executor {
+    stl::ThreadPool& pool_;
+    mutable std::atomic<size_t> calls_{0};
+
+public:
+    explicit GrowingExecutor(stl::ThreadPool& pool) : pool_(pool) {}
+
+    void submit(std::function<void()> task) override {
+        pool_.submit(std::move(task));
+    }
+
+    size_t concurrency() const override {
+        return calls_++ == 0 ? 1 : pool_.concurrency();
+    }
+};
+
+void test_changing_concurrency() {
+    auto large = generate_long_series();
+    std::vector<stl::StlParams> grid(8, stl::params());
+    stl::ThreadPool pool(8);
+    auto expected = stl::params().fit(large, 7);
+
+    GrowingExecutor fit_executor(pool);
+    assert(stl::params().executor(fit_executor).fit(large, 7).seasonal == expected.seasonal);
+
+    GrowingExecutor batch_executor(pool);
+    auto results = stl::params().batch(std::vector<std::vector<float>>(8, generate_series()), 7, batch_executor);
+    assert(results[7].seasonal == stl::params().fit(generate_series(), 7).seasonal);
+
+    GrowingExecutor rolling_executor(pool);
+    auto expected_rolling = stl::params().rolling(large.data(), 20000, 7, 200, 100);
+    auto rolling = stl::params().rolling(large.data(), 20000, 7, 200, 100, true, rolling_executor);
+    assert(rolling.back().seasonal == expected_rolling.back().seasonal);
+
+    GrowingExecutor grid_executor(pool);
+    auto scores = stl::grid_search(large.data(), 2000, 7, grid, grid_executor);
+    assert(scores[7].seasonal_strength == scores[0].seasonal_strength);
+}
+
+#ifdef STL_COROUTINES
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() {
+            return {};
+        }
+
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+
+        void return_void() {}
+
+        void unhandled_exception() {
+            std::terminate();
+        }
+    };
+};
+
+DetachedTask fit_coroutine(const std::vector<float>& series, std::vector<float>& seasonal, std::promise<void>& done, stl::Executor& executor) {
+    stl::StlOutput output;
+    output.seasonal = seasonal.data();
+    co_await stl::params().fit_awaitable(series.data(), series.size(), 7, output, executor);
+    done.set_value();
+}
+#endif
+
+void test_async() {
+    auto series = generate_series();
+    auto expected = stl::params().fit(series, 7);
+
+    stl::ThreadPool pool(2);
+    std::vector<float> seasonal(series.size());
+    std::vector<float> trend(series.size());
+    stl::StlOutput output;
+    output.seasonal = seasonal.data();
+    output.trend = trend.data();
+    auto future = stl::params().fit_async(series.data(), series.size(), 7, output, pool);
+    future.get();
+    assert(seasonal == expected.seasonal);
+    assert(trend == expected.trend);
+
+    auto failed = stl::params().fit_async(series.data(), series.size(), 16, output, pool);
+    ASSERT_EXCEPTION(failed.get(), std::invalid_argument, "series has less than two periods");
+
+#ifdef STL_COROUTINES
+    std::vector<float> awaited(series.size());
+    std::promise<void> done;
+    fit_coroutine(series, awaited, done, pool);
+    done.get_future().get();
+    assert(awaited == expected.seasonal);
+#endif
+}
+
+void test_reproducible() {
+    auto large = generate_long_series(65536);
+    std::vector<std::vector<float>> series = {std::vector<float>(large.begin(), large.begin() + 48), large};
+    std::vector<stl::StlParams> grid = {stl::params(), stl::params().seasonal_length(11).robust(true)};
+
+    auto expected = stl::params().fit(large, 24);
+    auto expected_robust = stl::params().robust(true).fit(large, 24);
+    auto expected_rolling = stl::params().rolling(large.data(), 2000, 24, 200, 100);
+    auto expected_grid = stl::grid_search(large, 24, grid);
+    for (size_t threads : {1, 2, 8, 64}) {
+        stl::ThreadPool pool(threads);
+        auto res = stl::params().executor(pool).fit(large, 24);
+        assert(res.seasonal == expected.seasonal);
+        assert(res.trend == expected.trend);
+        assert(res.weights == expected.weights);
+
+        auto robust = stl::params().robust(true).executor(pool).fit(large, 24);
+        assert(robust.seasonal == expected_robust.seasonal);
+        assert(robust.trend == expected_robust.trend);
+        assert(robust.weights == expected_robust.weights);
+
+        auto results = stl::params().batch(series, 24, pool);
+        assert(results[1].seasonal == expected.seasonal);
+
+        auto rolling = stl::params().rolling(large.data(), 2000, 24, 200, 100, true, pool);
+        auto grid_scores = stl::grid_search(large, 24, grid, pool);
+        for (size_t i = 0; i < rolling.size(); i++) {
+            assert(rolling[i].seasonal == expected_rolling[i].seasonal);
+            assert(rolling[i].trend == expected_rolling[i].trend);
+        }
+        for (size_t i = 0; i < grid.size(); i++) {
+            assert(grid_scores[i].seasonal_strength == expected_grid[i].seasonal_strength);
+            assert(grid_scores[i].min_weight == expected_grid[i].min_weight);
+        }
+    }
+}
+
+void test_fixed() {
+    auto series = generate_series();
+    stl::FixedStl<30, 7> fixed;
+    fixed.fit(series.data());
+    auto res = stl::params().fit(series, 7);
+    assert(std::vector<float>(fixed.seasonal.begin(), fixed.seasonal.end()) == res.seasonal);
+    assert(std::vector<float>(fixed.trend.begin(), fixed.trend.end()) == res.trend);
+    assert(std::vector<float>(fixed.remainder.begin(), fixed.remainder.end()) == res.remainder);
+
+    stl::FixedStl<30, 7, 0, 0, 0, 0, 1, true> robust;
+    robust.fit(series.data());
+    auto robust_res = stl::params().robust(true).fit(series, 7);
+    assert(std::vector<float>(robust.seasonal.begin(), robust.seasonal.end()) == robust_res.seasonal);
+    assert(std::vector<float>(robust.weights.begin(), robust.weights.end()) == robust_res.weights);
+}
+
 int main() {
     test_works();
     test_robust();
+    test_allocator();
+    test_strided();
+    test_integer_series();
+    test_output();
     test_too_few_periods();
     test_bad_seasonal_degree();
     test_seasonal_strength();
     test_trend_strength();
+    test_strengths();
+    test_estimate_strengths();
+    test_estimate_strengths_too_few_periods();
+    test_detect_periods();
+    test_detect_periods_too_short();
+    test_scan();
+    test_scan_too_few_periods();
+    test_grid_search();
+    test_rolling();
+    test_rolling_short_window();
+    test_anomalies();
+    test_forecast();
+    test_forecast_short_period();
+    test_forecast_offset();
+    test_forecast_long();
+    test_trend_slope();
+    test_trend_slope_offset();
+    test_quadratic_trend();
+    test_irregular();
+    test_loess();
+    test_limits();
+    test_cancel();
+    test_batch();
+    test_zero_concurrency();
+    test_changing_concurrency();
+    test_async();
+    test_reproducible();
+    test_fixed();
     return 0;
 }